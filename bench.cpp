@@ -0,0 +1,316 @@
+// This code is part of lilrcc project -> https://gitlab.com/pp2e/lilrcc
+// Generates synthetic archive and measures reader, library and writer on it.
+// Results are printed as JSON, so runs can be compared by scripts
+#include "compression.h"
+#include "lilrcc.h"
+#include "resourcereader.h"
+#include "resourcewriter.h"
+#include "tree.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTemporaryFile>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#define ASSERT(cond, message) if (!(cond)) {\
+    qCritical() << message;\
+    exit(1);\
+}\
+
+struct BenchConfig {
+    int entries = 10000;
+    int depth = 3;
+    int fanout = 8;
+    int minSize = 64;
+    int maxSize = 64*1024;
+    // Relative weights of codecs files are stored with
+    int codecWeights[3] = {1, 1, 1};
+    quint32 seed = 1;
+    int iterations = 3;
+    int addCount = 1000;
+    int jobs = 1;
+};
+
+static const Compression codecs[3] = {NoCompression, ZlibCompression, ZstdCompression};
+static const char *codecNames[3] = {"none", "zlib", "zstd"};
+
+// Text-like payload, so compressed sizes look like real resources
+static QByteArray generatePayload(QRandomGenerator &random, int size) {
+    static const char *words[] = {"qml", "import", "property", "Item", "width", "height", "anchors",
+                                  "fill", "parent", "color", "signal", "function", "return", "var",
+                                  "Rectangle", "Text", "id", "onClicked", "true", "false"};
+    QByteArray data;
+    data.reserve(size + 16);
+    while (data.size() < size) {
+        data += words[random.bounded(int(std::size(words)))];
+        data += random.bounded(8) ? ' ' : '\n';
+    }
+    data.truncate(size);
+    return data;
+}
+
+// Sizes are log-uniform between min and max, most files are small
+static int generateSize(QRandomGenerator &random, const BenchConfig &config) {
+    double minLog = std::log(double(config.minSize));
+    double maxLog = std::log(double(config.maxSize));
+    return int(std::exp(minLog + random.generateDouble()*(maxLog - minLog)));
+}
+
+static Compression generateCodec(QRandomGenerator &random, const BenchConfig &config) {
+    int total = config.codecWeights[0] + config.codecWeights[1] + config.codecWeights[2];
+    int pick = random.bounded(total);
+    for (int i = 0; i < 3; i++) {
+        if (pick < config.codecWeights[i])
+            return codecs[i];
+        pick -= config.codecWeights[i];
+    }
+    return NoCompression;
+}
+
+// Builds tree in memory, writes it to archive and returns paths of all files
+static QStringList generateArchive(const BenchConfig &config, QIODevice *device, quint64 &payloadSize) {
+    QRandomGenerator random(config.seed);
+    ResourceTreeDir root(":", 0);
+    QHash<QString, ResourceTreeDir*> dirs;
+    QStringList paths;
+    payloadSize = 0;
+    for (int i = 0; i < config.entries; i++) {
+        ResourceTreeDir *dir = &root;
+        QString path;
+        int depth = random.bounded(config.depth + 1);
+        for (int level = 0; level < depth; level++) {
+            QString name = QString("d%1").arg(random.bounded(config.fanout));
+            path += "/" + name;
+            ResourceTreeDir *&child = dirs[path];
+            if (!child) {
+                child = new ResourceTreeDir(name, qt_hash(name));
+                dir->insertChild(child);
+            }
+            dir = child;
+        }
+        QString name = QString("file%1.qml").arg(i);
+        QByteArray data = generatePayload(random, generateSize(random, config));
+        payloadSize += data.size();
+        Compression compression = generateCodec(random, config);
+        QByteArray stored = compression == NoCompression ? data : Lilrcc::compress(data, compression, -1);
+        dir->insertChild(new QByteArrayResourceTreeFile(name, qt_hash(name), stored, compression));
+        paths << path + "/" + name;
+    }
+    ResourceWriter writer(device);
+    writer.write(&root, 3);
+    return paths;
+}
+
+// Runs body iterations times, ops is amount of work done by one run
+static QJsonObject measure(const BenchConfig &config, qint64 ops, const std::function<void()> &body) {
+    QJsonArray runs;
+    double best = 0;
+    double total = 0;
+    for (int i = 0; i < config.iterations; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        body();
+        double seconds = timer.nsecsElapsed() / 1e9;
+        runs.append(seconds);
+        best = i == 0 ? seconds : std::min(best, seconds);
+        total += seconds;
+    }
+    QJsonObject result;
+    result["runs"] = runs;
+    result["best"] = best;
+    result["mean"] = total / config.iterations;
+    result["ops"] = ops;
+    result["opsPerSecond"] = best > 0 ? ops / best : 0;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("lilrcc benchmark on synthetic archive");
+    parser.addHelpOption();
+
+    QCommandLineOption entriesOption(QStringLiteral("entries"), QStringLiteral("Number of files in archive"), QStringLiteral("count"));
+    parser.addOption(entriesOption);
+    QCommandLineOption depthOption(QStringLiteral("depth"), QStringLiteral("Maximal directory depth of file"), QStringLiteral("depth"));
+    parser.addOption(depthOption);
+    QCommandLineOption fanoutOption(QStringLiteral("fanout"), QStringLiteral("Subdirectories in every directory"), QStringLiteral("count"));
+    parser.addOption(fanoutOption);
+    QCommandLineOption minSizeOption(QStringLiteral("min-size"), QStringLiteral("Smallest file size in bytes"), QStringLiteral("bytes"));
+    parser.addOption(minSizeOption);
+    QCommandLineOption maxSizeOption(QStringLiteral("max-size"), QStringLiteral("Largest file size in bytes"), QStringLiteral("bytes"));
+    parser.addOption(maxSizeOption);
+    QCommandLineOption codecsOption(QStringLiteral("codecs"), QStringLiteral("Codec weights as none:zlib:zstd, 1:1:1 by default"), QStringLiteral("weights"));
+    parser.addOption(codecsOption);
+    QCommandLineOption seedOption(QStringLiteral("seed"), QStringLiteral("Seed of generator"), QStringLiteral("seed"));
+    parser.addOption(seedOption);
+    QCommandLineOption iterationsOption(QStringLiteral("iterations"), QStringLiteral("Runs of every measurement"), QStringLiteral("count"));
+    parser.addOption(iterationsOption);
+    QCommandLineOption addOption(QStringLiteral("add"), QStringLiteral("Files added in add measurement"), QStringLiteral("count"));
+    parser.addOption(addOption);
+    QCommandLineOption jobsOption(QStringLiteral("j"), QStringLiteral("Number of threads used by repack"), QStringLiteral("jobs"));
+    parser.addOption(jobsOption);
+    QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write JSON results to file instead of stdout"), QStringLiteral("file"));
+    parser.addOption(outputOption);
+
+    parser.process(app);
+
+    BenchConfig config;
+    config.jobs = QThread::idealThreadCount();
+    auto intOption = [&](const QCommandLineOption &option, int &value, int minimum) {
+        if (!parser.isSet(option))
+            return;
+        bool ok;
+        value = parser.value(option).toInt(&ok);
+        ASSERT(ok && value >= minimum, "Option" << option.names().first() << "should be number not less than" << minimum)
+    };
+    intOption(entriesOption, config.entries, 1);
+    intOption(depthOption, config.depth, 0);
+    intOption(fanoutOption, config.fanout, 1);
+    intOption(minSizeOption, config.minSize, 1);
+    intOption(maxSizeOption, config.maxSize, config.minSize);
+    intOption(iterationsOption, config.iterations, 1);
+    intOption(addOption, config.addCount, 0);
+    intOption(jobsOption, config.jobs, 1);
+    if (parser.isSet(seedOption))
+        config.seed = parser.value(seedOption).toUInt();
+    if (parser.isSet(codecsOption)) {
+        QStringList weights = parser.value(codecsOption).split(':');
+        ASSERT(weights.size() == 3, "Codec weights should be none:zlib:zstd")
+        int total = 0;
+        for (int i = 0; i < 3; i++) {
+            bool ok;
+            config.codecWeights[i] = weights[i].toInt(&ok);
+            ASSERT(ok && config.codecWeights[i] >= 0, "Codec weight should be non-negative number")
+            total += config.codecWeights[i];
+        }
+        ASSERT(total > 0, "At least one codec weight should be positive")
+    }
+
+    QTemporaryFile archive;
+    ASSERT(archive.open(), "Cannot create temporary archive")
+    QElapsedTimer timer;
+    timer.start();
+    quint64 payloadSize;
+    QStringList paths = generateArchive(config, &archive, payloadSize);
+    archive.flush();
+    double generateSeconds = timer.nsecsElapsed() / 1e9;
+
+    QJsonObject results;
+    results["open"] = measure(config, 1, [&]() {
+        QFile file(archive.fileName());
+        file.open(QIODeviceBase::ReadOnly);
+        ResourceReader reader(&file);
+        ResourceLibrary lillib(&reader);
+        Lilrcc::Error error;
+        lillib.ls("/", error);
+    });
+
+    // Library stays open between runs, like in server or batch mode
+    QFile file(archive.fileName());
+    file.open(QIODeviceBase::ReadOnly);
+    ResourceReader reader(&file);
+    ResourceLibrary lillib(&reader);
+
+    results["lookup"] = measure(config, paths.size(), [&]() {
+        Lilrcc::Error error;
+        for (const QString &path : paths)
+            lillib.stat(path, error);
+    });
+    results["cat"] = measure(config, paths.size(), [&]() {
+        Lilrcc::Error error;
+        for (const QString &path : paths)
+            lillib.getFile(path, error);
+    });
+    results["catBatch"] = measure(config, paths.size(), [&]() {
+        QList<Lilrcc::Error> errors;
+        lillib.getFiles(paths, errors);
+    });
+    results["tree"] = measure(config, paths.size(), [&]() {
+        QString text;
+        QTextStream out(&text);
+        lillib.printTree(out);
+    });
+
+    // Changing measurements open their own library every run
+    results["repack"] = measure(config, paths.size(), [&]() {
+        QFile file(archive.fileName());
+        file.open(QIODeviceBase::ReadOnly);
+        ResourceReader reader(&file);
+        ResourceLibrary lillib(&reader);
+        Lilrcc::CompressionOptions options;
+        options.compression = ZstdCompression;
+        options.jobs = config.jobs;
+        lillib.compress(options);
+        QBuffer output;
+        output.open(QIODeviceBase::WriteOnly);
+        ResourceWriter writer(&output);
+        lillib.save(&writer);
+    });
+    QRandomGenerator random(config.seed + 1);
+    QList<QByteArray> addData;
+    for (int i = 0; i < config.addCount; i++)
+        addData << generatePayload(random, generateSize(random, config));
+    results["add"] = measure(config, config.addCount, [&]() {
+        QFile file(archive.fileName());
+        file.open(QIODeviceBase::ReadOnly);
+        ResourceReader reader(&file);
+        ResourceLibrary lillib(&reader);
+        Lilrcc::Error error;
+        for (int i = 0; i < addData.size(); i++)
+            lillib.addFile(addData[i], QString("added%1.qml").arg(i), "/", error);
+        QBuffer output;
+        output.open(QIODeviceBase::WriteOnly);
+        ResourceWriter writer(&output);
+        lillib.save(&writer);
+    });
+
+    QJsonObject configJson;
+    configJson["entries"] = config.entries;
+    configJson["depth"] = config.depth;
+    configJson["fanout"] = config.fanout;
+    configJson["minSize"] = config.minSize;
+    configJson["maxSize"] = config.maxSize;
+    QJsonObject codecsJson;
+    for (int i = 0; i < 3; i++)
+        codecsJson[codecNames[i]] = config.codecWeights[i];
+    configJson["codecs"] = codecsJson;
+    configJson["seed"] = qint64(config.seed);
+    configJson["iterations"] = config.iterations;
+    configJson["add"] = config.addCount;
+    configJson["jobs"] = config.jobs;
+
+    QJsonObject archiveJson;
+    archiveJson["size"] = archive.size();
+    archiveJson["payloadSize"] = qint64(payloadSize);
+    archiveJson["generateSeconds"] = generateSeconds;
+
+    QJsonObject report;
+    report["config"] = configJson;
+    report["archive"] = archiveJson;
+    report["results"] = results;
+    QByteArray json = QJsonDocument(report).toJson();
+
+    QFile output;
+    if (parser.isSet(outputOption)) {
+        output.setFileName(parser.value(outputOption));
+        output.open(QIODeviceBase::WriteOnly);
+    } else {
+        output.open(stdout, QIODeviceBase::WriteOnly);
+    }
+    ASSERT(output.isOpen(), "Cannot open output" << parser.value(outputOption))
+    output.write(json);
+    return 0;
+}
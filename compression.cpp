@@ -0,0 +1,461 @@
+#include "compression.h"
+#include "stats.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QtEndian>
+
+#include <zlib.h>
+#include <zstd.h>
+
+// Same as rcc uses by default
+static const int defaultZstdLevel = 14;
+// Piece of decompressed data passed between streaming codecs
+static const qsizetype streamChunkSize = 64*1024;
+
+using Lilrcc::ChunkSink;
+
+// Codec contexts are expensive to create, so every thread keeps its own
+struct ThreadContexts {
+    ~ThreadContexts() {
+        ZSTD_freeCCtx(zstdCompress);
+        ZSTD_freeDCtx(zstdDecompress);
+        if (inflateReady)
+            inflateEnd(&inflateStream);
+    }
+
+    ZSTD_CCtx *zstdCompress = nullptr;
+    ZSTD_DCtx *zstdDecompress = nullptr;
+    z_stream inflateStream = {};
+    bool inflateReady = false;
+};
+
+static thread_local ThreadContexts contexts;
+
+static ZSTD_CCtx *zstdCompressContext() {
+    if (!contexts.zstdCompress)
+        contexts.zstdCompress = ZSTD_createCCtx();
+    return contexts.zstdCompress;
+}
+
+static ZSTD_DCtx *zstdDecompressContext() {
+    if (!contexts.zstdDecompress)
+        contexts.zstdDecompress = ZSTD_createDCtx();
+    return contexts.zstdDecompress;
+}
+
+static z_stream *inflateContext() {
+    if (!contexts.inflateReady) {
+        if (inflateInit(&contexts.inflateStream) != Z_OK)
+            return nullptr;
+        contexts.inflateReady = true;
+    } else if (inflateReset(&contexts.inflateStream) != Z_OK) {
+        return nullptr;
+    }
+    return &contexts.inflateStream;
+}
+
+// Sizes stored in payloads are only allocated up to deflate's best ratio
+// of compressed size, bigger ones are reached by growing the buffer
+static qsizetype trustedSize(qsizetype compressedSize) {
+    return 1032*compressedSize + 64;
+}
+
+// Data is in qCompress format, 4 bytes of expected size and zlib stream
+static bool zlibUncompress(const QByteArray &data, QByteArray &out) {
+    if (data.size() < 4)
+        return false;
+    z_stream *stream = inflateContext();
+    if (!stream)
+        return false;
+
+    // Size comes from archive, buffer beyond what deflate can give is not
+    // allocated up front and grows below if size was right after all
+    qsizetype expected = qFromBigEndian<quint32>(data.constData());
+    out.resize(qMin(expected, trustedSize(data.size())));
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData() + 4));
+    stream->avail_in = data.size() - 4;
+    while (true) {
+        stream->next_out = reinterpret_cast<Bytef*>(out.data() + stream->total_out);
+        stream->avail_out = out.size() - stream->total_out;
+        int result = inflate(stream, Z_FINISH);
+        if (result == Z_STREAM_END) {
+            out.resize(stream->total_out);
+            return true;
+        }
+        if (result != Z_OK && result != Z_BUF_ERROR)
+            return false;
+        // Stream is truncated
+        if (stream->avail_out != 0)
+            return false;
+        // Expected size was wrong, continue with bigger buffer
+        out.resize(qMax<qsizetype>(2*out.size(), 64));
+    }
+}
+
+static bool zstdUncompressChunks(const QByteArray &data, const ChunkSink &sink);
+
+static bool zstdUncompress(const QByteArray &data, QByteArray &out) {
+    unsigned long long uncompressedSize = ZSTD_getFrameContentSize(data.constData(), data.size());
+    if (uncompressedSize == ZSTD_CONTENTSIZE_ERROR)
+        return false;
+    // Streaming compressors may not write size, data is collected then.
+    // Size way above what frame can hold is not trusted either
+    if (uncompressedSize == ZSTD_CONTENTSIZE_UNKNOWN || uncompressedSize > quint64(trustedSize(data.size()))) {
+        out.clear();
+        return zstdUncompressChunks(data, [&out](const char *chunk, qsizetype size) {
+            out.append(chunk, size);
+            return true;
+        });
+    }
+    ZSTD_DCtx *context = zstdDecompressContext();
+    if (!context)
+        return false;
+    out.resize(uncompressedSize);
+    size_t size = ZSTD_decompressDCtx(context, out.data(), uncompressedSize, data.constData(), data.size());
+    if (ZSTD_isError(size))
+        return false;
+    out.resize(size);
+    return true;
+}
+
+static bool zlibUncompressChunks(const QByteArray &data, const ChunkSink &sink) {
+    if (data.size() < 4)
+        return false;
+    z_stream *stream = inflateContext();
+    if (!stream)
+        return false;
+
+    QByteArray buffer(streamChunkSize, Qt::Uninitialized);
+    stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData() + 4));
+    stream->avail_in = data.size() - 4;
+    while (true) {
+        stream->next_out = reinterpret_cast<Bytef*>(buffer.data());
+        stream->avail_out = buffer.size();
+        int result = inflate(stream, Z_NO_FLUSH);
+        qsizetype produced = buffer.size() - stream->avail_out;
+        if (produced > 0 && !sink(buffer.constData(), produced))
+            return false;
+        if (result == Z_STREAM_END)
+            return true;
+        // Buffer error here means stream is truncated
+        if (result != Z_OK)
+            return false;
+    }
+}
+
+static bool zstdUncompressChunks(const QByteArray &data, const ChunkSink &sink) {
+    ZSTD_DCtx *context = zstdDecompressContext();
+    if (!context)
+        return false;
+    ZSTD_DCtx_reset(context, ZSTD_reset_session_only);
+
+    QByteArray buffer(streamChunkSize, Qt::Uninitialized);
+    ZSTD_inBuffer input = {data.constData(), size_t(data.size()), 0};
+    while (true) {
+        ZSTD_outBuffer output = {buffer.data(), size_t(buffer.size()), 0};
+        size_t result = ZSTD_decompressStream(context, &output, &input);
+        if (ZSTD_isError(result))
+            return false;
+        if (output.pos > 0 && !sink(buffer.constData(), output.pos))
+            return false;
+        // Frame is complete and there are no more frames
+        if (result == 0 && input.pos == input.size)
+            return true;
+        // Stream is truncated
+        if (input.pos == input.size && output.pos < output.size)
+            return false;
+    }
+}
+
+static bool decodeChunks(const QByteArray &data, Compression compression, const ChunkSink &sink) {
+    switch (compression) {
+    case NoCompression:
+        for (qsizetype pos = 0; pos < data.size(); pos += streamChunkSize) {
+            if (!sink(data.constData() + pos, qMin(streamChunkSize, data.size() - pos)))
+                return false;
+        }
+        return true;
+    case ZlibCompression:
+        return zlibUncompressChunks(data, sink);
+    case ZstdCompression:
+        return zstdUncompressChunks(data, sink);
+    }
+    return false;
+}
+
+// Compresses chunks into out in form stored in rcc. Size of whole data
+// must be known before, Qt reads it from zstd frame header
+class StreamCompressor {
+public:
+    StreamCompressor(Compression compression, int level, qint64 size, QByteArray &out)
+        : m_compression(compression)
+        , m_out(out)
+        , m_ready(false)
+    {
+        m_out.clear();
+        if (m_compression == ZlibCompression) {
+            // qCompress header, written again when real size is known
+            m_out.resize(4);
+            qToBigEndian<quint32>(size, m_out.data());
+            m_deflate = {};
+            m_ready = deflateInit(&m_deflate, level) == Z_OK;
+        } else if (m_compression == ZstdCompression) {
+            m_zstd = zstdCompressContext();
+            m_ready = m_zstd
+                      && !ZSTD_isError(ZSTD_CCtx_reset(m_zstd, ZSTD_reset_session_only))
+                      && !ZSTD_isError(ZSTD_CCtx_setParameter(m_zstd, ZSTD_c_compressionLevel, level < 0 ? defaultZstdLevel : level))
+                      && !ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(m_zstd, size));
+        } else {
+            m_ready = true;
+        }
+    }
+
+    ~StreamCompressor() {
+        if (m_compression == ZlibCompression && m_ready)
+            deflateEnd(&m_deflate);
+    }
+
+    bool add(const char *data, qsizetype size) {
+        if (!m_ready)
+            return false;
+        if (m_compression == ZlibCompression)
+            return deflateChunk(data, size, Z_NO_FLUSH);
+        if (m_compression == ZstdCompression)
+            return zstdChunk(data, size, ZSTD_e_continue);
+        m_out.append(data, size);
+        return true;
+    }
+
+    bool finish() {
+        if (!m_ready)
+            return false;
+        if (m_compression == ZlibCompression) {
+            if (!deflateChunk(nullptr, 0, Z_FINISH))
+                return false;
+            qToBigEndian<quint32>(m_deflate.total_in, m_out.data());
+            return true;
+        }
+        if (m_compression == ZstdCompression)
+            return zstdChunk(nullptr, 0, ZSTD_e_end);
+        return true;
+    }
+
+private:
+    bool deflateChunk(const char *data, qsizetype size, int flush) {
+        m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        m_deflate.avail_in = size;
+        while (true) {
+            qsizetype used = m_out.size();
+            m_out.resize(used + streamChunkSize);
+            m_deflate.next_out = reinterpret_cast<Bytef*>(m_out.data() + used);
+            m_deflate.avail_out = streamChunkSize;
+            int result = deflate(&m_deflate, flush);
+            m_out.resize(used + streamChunkSize - m_deflate.avail_out);
+            if (result == Z_STREAM_ERROR)
+                return false;
+            if (flush == Z_FINISH) {
+                if (result == Z_STREAM_END)
+                    return true;
+            } else if (m_deflate.avail_in == 0 && m_deflate.avail_out != 0) {
+                return true;
+            }
+        }
+    }
+
+    bool zstdChunk(const char *data, qsizetype size, ZSTD_EndDirective directive) {
+        ZSTD_inBuffer input = {data, size_t(size), 0};
+        while (true) {
+            qsizetype used = m_out.size();
+            m_out.resize(used + streamChunkSize);
+            ZSTD_outBuffer output = {m_out.data() + used, size_t(streamChunkSize), 0};
+            size_t result = ZSTD_compressStream2(m_zstd, &output, &input, directive);
+            m_out.resize(used + output.pos);
+            if (ZSTD_isError(result))
+                return false;
+            if (directive == ZSTD_e_end ? result == 0 : input.pos == input.size)
+                return true;
+        }
+    }
+
+    Compression m_compression;
+    QByteArray &m_out;
+    bool m_ready;
+    z_stream m_deflate;
+    ZSTD_CCtx *m_zstd = nullptr;
+};
+
+bool Lilrcc::validLevel(Compression compression, int level) {
+    switch (compression) {
+    case NoCompression:
+        return true;
+    case ZlibCompression:
+        return level >= -1 && level <= 9;
+    case ZstdCompression:
+        return level >= -1 && level <= ZSTD_maxCLevel();
+    }
+    return false;
+}
+
+static QByteArray compressData(const QByteArray &data, Compression compression, int level) {
+    switch (compression) {
+    case NoCompression:
+        return data;
+    case ZlibCompression:
+        // qCompress format is what rcc stores and qUncompress reads
+        return qCompress(data, level);
+    case ZstdCompression: {
+        if (level < 0)
+            level = defaultZstdLevel;
+        ZSTD_CCtx *context = zstdCompressContext();
+        if (!context)
+            return {};
+        QByteArray compressed;
+        compressed.resize(ZSTD_compressBound(data.size()));
+        size_t size = ZSTD_compressCCtx(context, compressed.data(), compressed.size(), data.constData(), data.size(), level);
+        if (ZSTD_isError(size))
+            return {};
+        compressed.resize(size);
+        return compressed;
+    }
+    }
+    return {};
+}
+
+QByteArray Lilrcc::compress(const QByteArray &data, Compression compression, int level) {
+    QElapsedTimer timer;
+    timer.start();
+    QByteArray compressed = compressData(data, compression, level);
+    stats().compress[codecIndex(compression)].add(data.size(), compressed.size(), timer.nsecsElapsed());
+    return compressed;
+}
+
+QByteArray Lilrcc::compress(const QByteArray &data, const CompressionOptions &options, Compression &compression) {
+    QList<Compression> codecs;
+    if (options.automatic)
+        codecs << ZlibCompression << ZstdCompression;
+    else if (options.compression != NoCompression)
+        codecs << options.compression;
+    QByteArray best = data;
+    compression = NoCompression;
+    for (Compression codec : std::as_const(codecs)) {
+        QByteArray compressed = compress(data, codec, options.level);
+        if (compressed.isNull() || !meetsThreshold(data.size(), compressed.size(), options.threshold))
+            continue;
+        if (compression == NoCompression || compressed.size() < best.size()) {
+            best = compressed;
+            compression = codec;
+        }
+    }
+    return best;
+}
+
+bool Lilrcc::meetsThreshold(qsizetype originalSize, qsizetype compressedSize, int threshold) {
+    if (originalSize == 0 || compressedSize >= originalSize)
+        return false;
+    // Same formula rcc uses
+    return 100.0*(originalSize - compressedSize)/originalSize >= threshold;
+}
+
+QByteArray Lilrcc::uncompress(const QByteArray &data, Compression compression, Error &error) {
+    QByteArray out;
+    uncompress(data, compression, out, error);
+    return out;
+}
+
+bool Lilrcc::uncompress(const QByteArray &data, Compression compression, QByteArray &out, Error &error) {
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = false;
+    switch (compression) {
+    case NoCompression:
+        out = data;
+        ok = true;
+        break;
+    case ZlibCompression:
+        ok = zlibUncompress(data, out);
+        break;
+    case ZstdCompression:
+        ok = zstdUncompress(data, out);
+        break;
+    }
+    if (!ok) {
+        error = CannotUncompress;
+        out.clear();
+    }
+    stats().uncompress[codecIndex(compression)].add(data.size(), out.size(), timer.nsecsElapsed());
+    return ok;
+}
+
+qint64 Lilrcc::uncompressedSize(const QByteArray &data, Compression compression) {
+    switch (compression) {
+    case NoCompression:
+        return data.size();
+    case ZlibCompression:
+        if (data.size() < 4)
+            return -1;
+        return qFromBigEndian<quint32>(data.constData());
+    case ZstdCompression: {
+        unsigned long long size = ZSTD_getFrameContentSize(data.constData(), data.size());
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR)
+            return -1;
+        return size;
+    }
+    }
+    return -1;
+}
+
+bool Lilrcc::transcode(const QByteArray &data, Compression from, Compression to, int level, QByteArray &out, Error &error) {
+    if (from == to) {
+        out = data;
+        return true;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    auto encode = [&](qint64 size) {
+        StreamCompressor compressor(to, level, size, out);
+        return decodeChunks(data, from, [&compressor](const char *chunk, qsizetype chunkSize) {
+            return compressor.add(chunk, chunkSize);
+        }) && compressor.finish();
+    };
+    // Frame without size is decoded twice, first time only to count bytes.
+    // zstd checks size it pledges, so wrong qCompress header is counted too
+    auto countSize = [&](qint64 &size) {
+        size = 0;
+        return decodeChunks(data, from, [&size](const char *, qsizetype chunkSize) {
+            size += chunkSize;
+            return true;
+        });
+    };
+    qint64 size = uncompressedSize(data, from);
+    bool ok;
+    if (size < 0)
+        ok = countSize(size) && encode(size);
+    else
+        ok = encode(size) || (from == ZlibCompression && to == ZstdCompression && countSize(size) && encode(size));
+    if (!ok) {
+        error = CannotUncompress;
+        out.clear();
+    }
+    stats().compress[codecIndex(to)].add(data.size(), out.size(), timer.nsecsElapsed());
+    return ok;
+}
+
+bool Lilrcc::uncompressChunks(const QByteArray &data, Compression compression, const ChunkSink &sink, Error &error) {
+    QElapsedTimer timer;
+    timer.start();
+    qint64 produced = 0;
+    bool stopped = false;
+    bool ok = decodeChunks(data, compression, [&](const char *chunk, qsizetype size) {
+        produced += size;
+        if (!sink(chunk, size)) {
+            stopped = true;
+            return false;
+        }
+        return true;
+    });
+    if (!ok && !stopped)
+        error = CannotUncompress;
+    stats().uncompress[codecIndex(compression)].add(data.size(), produced, timer.nsecsElapsed());
+    return ok;
+}
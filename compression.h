@@ -0,0 +1,48 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "error.h"
+#include "tree.h"
+
+#include <QByteArray>
+
+namespace Lilrcc {
+
+struct CompressionOptions {
+    Compression compression = NoCompression;
+    // Every file is tried with zlib and zstd and smallest result is kept,
+    // compression is ignored then
+    bool automatic = false;
+    // -1 means default level of codec
+    int level = -1;
+    // Percent of size compression should save to be kept, like rcc -threshold
+    int threshold = 0;
+    int jobs = 1;
+};
+
+// Whether codec has level, zlib has -1 to 9 and zstd -1 to ZSTD_maxCLevel
+bool validLevel(Compression compression, int level);
+
+// Whether compressed data saves enough of original size
+bool meetsThreshold(qsizetype originalSize, qsizetype compressedSize, int threshold);
+
+// Compresses data to the form stored in rcc, returns null array on failure
+QByteArray compress(const QByteArray &data, Compression compression, int level);
+// Compresses data as options say, automatic mode keeps smallest codec.
+// Data is returned as is with NoCompression if result misses threshold
+QByteArray compress(const QByteArray &data, const CompressionOptions &options, Compression &compression);
+QByteArray uncompress(const QByteArray &data, Compression compression, Error &error);
+// Decompresses into out reusing its memory, codec contexts are cached per thread
+bool uncompress(const QByteArray &data, Compression compression, QByteArray &out, Error &error);
+// Decompresses in fixed size chunks, so whole data is never in memory.
+// Returns false if sink stopped it too, error is not set then
+bool uncompressChunks(const QByteArray &data, Compression compression, const ChunkSink &sink, Error &error);
+// Size of decompressed data as stored in its header, -1 if it is not known
+qint64 uncompressedSize(const QByteArray &data, Compression compression);
+// Converts data stored with one codec to another. Decompressed data goes
+// from decoder to encoder in small chunks and is never kept whole
+bool transcode(const QByteArray &data, Compression from, Compression to, int level, QByteArray &out, Error &error);
+
+}
+
+#endif // COMPRESSION_H
@@ -20,6 +20,24 @@ void Lilrcc::printError(Error error) {
     case GotDirInsteadOfFile:
         qCritical() << "Lilrcc: Got directory instead of the file";
         break;
+    case CannotWriteFile:
+        qCritical() << "Lilrcc: Cannot write file";
+        break;
+    case CannotConnect:
+        qCritical() << "Lilrcc: Cannot talk to server";
+        break;
+    case EntryConflict:
+        qCritical() << "Lilrcc: Entry exists in more than one merged archive";
+        break;
+    case InvalidPatch:
+        qCritical() << "Lilrcc: Patch is damaged or made for other archive";
+        break;
+    case InvalidQrc:
+        qCritical() << "Lilrcc: Qrc file is not valid";
+        break;
+    case CannotReadFile:
+        qCritical() << "Lilrcc: Cannot read file";
+        break;
     default:
         qDebug() << "Could not find error" << error;
     }
@@ -11,7 +11,13 @@ enum Error {
     CannotUncompress,
     GotFileInsteadOfDir,
     EntryNotFound,
-    GotDirInsteadOfFile
+    GotDirInsteadOfFile,
+    CannotWriteFile,
+    CannotConnect,
+    EntryConflict,
+    InvalidPatch,
+    InvalidQrc,
+    CannotReadFile
 };
 
 void printError(Error error);
@@ -0,0 +1,247 @@
+#include "fileio.h"
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#ifdef LILRCC_IO_URING
+#include <liburing.h>
+#endif
+
+// Deep enough to keep NVMe busy, small enough for buffers to stay cheap
+static int queueDepth = 32;
+
+#ifdef Q_OS_LINUX
+// Finishes copy which kernel refused to do in the middle
+static bool copyThroughUserspace(int inFd, loff_t offset, int outFd, qint64 length) {
+    char buffer[64*1024];
+    while (length > 0) {
+        ssize_t got = pread(inFd, buffer, qMin<qint64>(length, sizeof(buffer)), offset);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        ssize_t written = 0;
+        while (written < got) {
+            ssize_t result = write(outFd, buffer+written, got-written);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result <= 0)
+                return false;
+            written += result;
+        }
+        offset += got;
+        length -= got;
+    }
+    return true;
+}
+#endif
+
+Lilrcc::CopyResult Lilrcc::copyFileRange(int inFd, qint64 offset, int outFd, qint64 length) {
+#ifdef Q_OS_LINUX
+    // Pipes have no position, -1 here
+    off_t outStart = lseek(outFd, 0, SEEK_CUR);
+    loff_t inOffset = offset;
+    qint64 copied = 0;
+    bool useCopyFileRange = true;
+    while (copied < length) {
+        ssize_t result;
+        if (useCopyFileRange) {
+            result = copy_file_range(inFd, &inOffset, outFd, nullptr, length-copied, 0);
+            if (result < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS
+                               || errno == EOPNOTSUPP || errno == EBADF)) {
+                // Not supported for these files, output is pipe for example
+                useCopyFileRange = false;
+                continue;
+            }
+        } else {
+            off_t sendOffset = inOffset;
+            result = sendfile(outFd, inFd, &sendOffset, length-copied);
+            if (result > 0)
+                inOffset = sendOffset;
+        }
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0) {
+            if (copied == 0)
+                return NotCopied;
+            if (copyThroughUserspace(inFd, inOffset, outFd, length-copied))
+                return Copied;
+            // Fallback of caller will write the whole range again over this one
+            if (outStart >= 0 && lseek(outFd, outStart, SEEK_SET) == outStart)
+                return NotCopied;
+            return CopyFailed;
+        }
+        copied += result;
+    }
+    return Copied;
+#else
+    Q_UNUSED(inFd)
+    Q_UNUSED(offset)
+    Q_UNUSED(outFd)
+    Q_UNUSED(length)
+    return NotCopied;
+#endif
+}
+
+void Lilrcc::setIoQueueDepth(int depth) {
+    queueDepth = qMax(1, depth);
+}
+
+int Lilrcc::ioQueueDepth() {
+    return queueDepth;
+}
+
+Lilrcc::IoBatch::IoBatch()
+    : m_queueDepth(queueDepth)
+    , m_ring(nullptr)
+    , m_ringTried(false)
+{
+}
+
+Lilrcc::IoBatch::~IoBatch() {
+    closeRing();
+}
+
+void Lilrcc::IoBatch::closeRing() {
+#ifdef LILRCC_IO_URING
+    if (m_ring) {
+        io_uring_queue_exit(static_cast<io_uring*>(m_ring));
+        delete static_cast<io_uring*>(m_ring);
+        m_ring = nullptr;
+    }
+#endif
+}
+
+void Lilrcc::IoBatch::read(int fd, qint64 offset, char *buffer, qint64 size) {
+    m_requests << Request{fd, offset, buffer, size, false};
+}
+
+void Lilrcc::IoBatch::write(int fd, qint64 offset, const char *buffer, qint64 size) {
+    m_requests << Request{fd, offset, const_cast<char*>(buffer), size, true};
+}
+
+qsizetype Lilrcc::IoBatch::size() {
+    return m_requests.size();
+}
+
+bool Lilrcc::IoBatch::submit() {
+#ifdef LILRCC_IO_URING
+    if (!m_ringTried && m_queueDepth > 1 && m_requests.size() > 1) {
+        m_ringTried = true;
+        io_uring *ring = new io_uring;
+        // Kernel may be too old or io_uring forbidden by seccomp
+        if (io_uring_queue_init(m_queueDepth, ring, 0) == 0)
+            m_ring = ring;
+        else
+            delete ring;
+    }
+#endif
+    bool ok = true;
+    if (m_ring) {
+        ok = runRing();
+    } else {
+        for (const Request &request : std::as_const(m_requests))
+            ok = runSerial(request) && ok;
+    }
+    m_requests.clear();
+    return ok;
+}
+
+// Also finishes requests io_uring did only partially
+bool Lilrcc::IoBatch::runSerial(Request request) {
+#ifdef Q_OS_LINUX
+    while (request.size > 0) {
+        ssize_t result = request.write ? pwrite(request.fd, request.buffer, request.size, request.offset)
+                                       : pread(request.fd, request.buffer, request.size, request.offset);
+        if (result < 0 && errno == EINTR)
+            continue;
+        // Zero means read past end of file
+        if (result <= 0)
+            return false;
+        request.buffer += result;
+        request.offset += result;
+        request.size -= result;
+    }
+    return true;
+#else
+    Q_UNUSED(request)
+    return false;
+#endif
+}
+
+bool Lilrcc::IoBatch::runRing() {
+#ifdef LILRCC_IO_URING
+    io_uring *ring = static_cast<io_uring*>(m_ring);
+    bool ok = true;
+    qsizetype next = 0;
+    qsizetype done = 0;
+    int inFlight = 0;
+    while (done < m_requests.size()) {
+        // Queue is refilled as requests complete
+        int prepared = 0;
+        while (next < m_requests.size() && inFlight < m_queueDepth) {
+            io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            if (!sqe)
+                break;
+            const Request &request = m_requests.at(next);
+            if (request.write)
+                io_uring_prep_write(sqe, request.fd, request.buffer, request.size, request.offset);
+            else
+                io_uring_prep_read(sqe, request.fd, request.buffer, request.size, request.offset);
+            io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(quintptr(next)));
+            next++;
+            inFlight++;
+            prepared++;
+        }
+        int submitted = io_uring_submit_and_wait(ring, 1);
+        if (submitted < 0 && submitted != -EINTR && submitted != -EAGAIN && submitted != -EBUSY) {
+            // Ring cannot be used anymore. Requests submitted before still
+            // use buffers of caller, so they are waited for before it gets
+            // them back
+            int running = inFlight - prepared;
+            io_uring_cqe *cqe;
+            while (running > 0) {
+                int result = io_uring_wait_cqe(ring, &cqe);
+                if (result == -EINTR)
+                    continue;
+                if (result < 0)
+                    break;
+                io_uring_cqe_seen(ring, cqe);
+                running--;
+            }
+            // Later batches go through pread and pwrite
+            closeRing();
+            return false;
+        }
+
+        io_uring_cqe *cqe;
+        while (io_uring_peek_cqe(ring, &cqe) == 0) {
+            const Request &request = m_requests.at(qsizetype(quintptr(io_uring_cqe_get_data(cqe))));
+            int result = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            inFlight--;
+            done++;
+            if (result == -EINTR || result == -EAGAIN)
+                result = 0;
+            else if (result <= 0 && request.size > 0) {
+                ok = false;
+                continue;
+            }
+            // Short transfer, rest is done here
+            if (result < request.size) {
+                Request rest = request;
+                rest.buffer += result;
+                rest.offset += result;
+                rest.size -= result;
+                ok = runSerial(rest) && ok;
+            }
+        }
+    }
+    return ok;
+#else
+    return false;
+#endif
+}
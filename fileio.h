@@ -0,0 +1,65 @@
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <QList>
+#include <QtGlobal>
+
+namespace Lilrcc {
+
+enum CopyResult {
+    Copied,
+    // Output is as it was before, caller can fall back to usual reads and writes
+    NotCopied,
+    // Part of range was written and output cannot be moved back, falling back
+    // would write it twice
+    CopyFailed
+};
+
+// Copies length bytes starting at offset of inFd to current position of outFd
+// inside the kernel (copy_file_range or sendfile). If copy breaks in the
+// middle, outFd is moved back to where copy started
+CopyResult copyFileRange(int inFd, qint64 offset, int outFd, qint64 length);
+
+// How many requests IoBatch keeps in flight, 1 makes all I/O serial
+void setIoQueueDepth(int depth);
+int ioQueueDepth();
+
+// Positioned reads and writes done together. With io_uring (LILRCC_IO_URING)
+// up to ioQueueDepth requests are in flight at once, otherwise or if
+// kernel refuses io_uring they are done one by one with pread and pwrite
+class IoBatch {
+public:
+    IoBatch();
+    ~IoBatch();
+    IoBatch(const IoBatch &) = delete;
+    IoBatch &operator=(const IoBatch &) = delete;
+    // Buffers must stay valid until submit returns
+    void read(int fd, qint64 offset, char *buffer, qint64 size);
+    void write(int fd, qint64 offset, const char *buffer, qint64 size);
+    qsizetype size();
+    // Runs and forgets all queued requests, returns false if any failed
+    bool submit();
+
+private:
+    struct Request {
+        int fd;
+        qint64 offset;
+        char *buffer;
+        qint64 size;
+        bool write;
+    };
+    static bool runSerial(Request request);
+    bool runRing();
+    void closeRing();
+
+    QList<Request> m_requests;
+    int m_queueDepth;
+    // io_uring, nullptr if it is not used. It is set up by first submit
+    // of more than one request, so single writes never pay for it
+    void *m_ring;
+    bool m_ringTried;
+};
+
+}
+
+#endif // FILEIO_H
@@ -1,12 +1,21 @@
 #include "lilrcc.h"
+#include "fileio.h"
 
+#include <QAtomicInt>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QIODevice>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include <algorithm>
 
 ResourceLibrary::ResourceLibrary(ResourceReader *reader)
-    : m_root(":", 0)
+    : m_reader(reader)
+    , m_root(":", 0, reader, 0)
+    , m_pathIndexBuilt(false)
 {
-    reader->readTreeDirChildren(&m_root, 0);
 }
 
 void ResourceLibrary::printTree(QTextStream &out) {
@@ -30,21 +39,102 @@ QList<QString> ResourceLibrary::ls(QString path, Lilrcc::Error &error) {
     return entries;
 }
 
-QByteArray ResourceLibrary::getFile(QString path, Lilrcc::Error &error) {
+QString ResourceLibrary::stat(QString path, Lilrcc::Error &error) {
     QStringList pathSegments = parsePath(path);
     ResourceTreeNode *node = getNode(pathSegments, error);
     if (error != Lilrcc::NoError) return {};
     if (node->isDir()) {
-        error = Lilrcc::GotFileInsteadOfDir;
-        return {};
+        ResourceTreeDir *dir = static_cast<ResourceTreeDir*>(node);
+        return QString("Type: dir\nChildren: %1\n").arg(dir->children().size());
     }
     ResourceTreeFile *file = static_cast<ResourceTreeFile*>(node);
+    QString compression = "none";
+    if (file->getCompression() == ZlibCompression)
+        compression = "zlib";
+    else if (file->getCompression() == ZstdCompression)
+        compression = "zstd";
+    return QString("Type: file\nCompression: %1\nSize: %2\n").arg(compression).arg(file->dataSize()-4);
+}
+
+QByteArray ResourceLibrary::getFile(QString path, Lilrcc::Error &error) {
+    ResourceTreeFile *file = getFileNode(path, error);
+    if (!file) return {};
     QByteArray data = file->read(error);
     if (error != Lilrcc::NoError) return {};
 
     return data;
 }
 
+bool ResourceLibrary::readFile(QString path, const Lilrcc::ChunkSink &sink, Lilrcc::Error &error) {
+    ResourceTreeFile *file = getFileNode(path, error);
+    if (!file) return false;
+    return file->readChunks(sink, error);
+}
+
+bool ResourceLibrary::writeFile(QString path, QIODevice *device, Lilrcc::Error &error) {
+    ResourceTreeFile *file = getFileNode(path, error);
+    if (!file) return false;
+    Lilrcc::CopyResult copied = file->copyUncompressed(device);
+    if (copied == Lilrcc::Copied)
+        return true;
+    if (copied == Lilrcc::CopyFailed) {
+        error = Lilrcc::CannotWriteFile;
+        return false;
+    }
+    bool writeFailed = false;
+    file->readChunks([device, &writeFailed](const char *chunk, qsizetype size) {
+        writeFailed = device->write(chunk, size) != size;
+        return !writeFailed;
+    }, error);
+    if (writeFailed)
+        error = Lilrcc::CannotWriteFile;
+    return error == Lilrcc::NoError;
+}
+
+QByteArray ResourceLibrary::readRange(QString path, qint64 offset, qint64 length, Lilrcc::Error &error) {
+    ResourceTreeFile *file = getFileNode(path, error);
+    if (!file) return {};
+    return file->readRange(offset, length, error);
+}
+
+QList<QByteArray> ResourceLibrary::getFiles(const QStringList &paths, QList<Lilrcc::Error> &errors) {
+    buildPathIndex();
+    QList<QByteArray> files;
+    files.reserve(paths.size());
+    errors.clear();
+    errors.reserve(paths.size());
+    for (const QString &path : paths) {
+        Lilrcc::Error error = Lilrcc::NoError;
+        files << getFile(path, error);
+        errors << error;
+    }
+    return files;
+}
+
+void ResourceLibrary::buildPathIndex() {
+    if (m_pathIndexBuilt)
+        return;
+    m_pathIndex.clear();
+    m_pathIndex.insert(QString(), &m_root);
+    QList<QPair<ResourceTreeDir*, QString>> pending;
+    pending << qMakePair(&m_root, QString());
+    while (!pending.isEmpty()) {
+        auto [dir, dirPath] = pending.takeFirst();
+        for (ResourceTreeNode *child : dir->children()) {
+            QString path = dirPath.isEmpty() ? child->name() : dirPath + "/" + child->name();
+            m_pathIndex.insert(path, child);
+            if (child->isDir())
+                pending << qMakePair(static_cast<ResourceTreeDir*>(child), path);
+        }
+    }
+    m_pathIndexBuilt = true;
+}
+
+void ResourceLibrary::invalidatePathIndex() {
+    m_pathIndex.clear();
+    m_pathIndexBuilt = false;
+}
+
 bool ResourceLibrary::rmFile(QString path, Lilrcc::Error &error) {
     QStringList pathSegments = parsePath(path);
     QString nodeName = pathSegments.takeLast();
@@ -55,9 +145,14 @@ bool ResourceLibrary::rmFile(QString path, Lilrcc::Error &error) {
         return false;
     }
     ResourceTreeDir *dir = static_cast<ResourceTreeDir*>(node);
-    ResourceTreeNode *child = binSearchNode(dir->children(), qt_hash(nodeName));
-    delete child;
+    ResourceTreeNode *child = binSearchNode(dir->children(), nodeName);
+    if (!child) {
+        error = Lilrcc::EntryNotFound;
+        return false;
+    }
+    invalidatePathIndex();
     dir->removeChild(child);
+    delete child;
     return true;
 }
 
@@ -71,11 +166,12 @@ bool ResourceLibrary::mvFile(QString source, QString dest, Lilrcc::Error &error)
         return false;
     }
     ResourceTreeDir *dir = static_cast<ResourceTreeDir*>(node);
-    ResourceTreeNode *child = binSearchNode(dir->children(), qt_hash(sourceName));
+    ResourceTreeNode *child = binSearchNode(dir->children(), sourceName);
     if (!child) {
         error = Lilrcc::EntryNotFound;
         return false;
     }
+    invalidatePathIndex();
     dir->removeChild(child);
 
     QStringList destSegments = parsePath(dest);
@@ -109,14 +205,523 @@ bool ResourceLibrary::addFile(QByteArray data, QString name, QString dest, Lilrc
         return false;
     }
     ResourceTreeDir *destDir = static_cast<ResourceTreeDir*>(destNode);
+    invalidatePathIndex();
     destDir->insertChild(file);
     return true;
 }
 
+// Payloads read ahead in one batch by compress and extract stop at this size
+static const qint64 maxBatchBytes = 16*1024*1024;
+
+// What compress does with one file, replace is false if it stays as is
+struct CompressJob {
+    QByteArray result;
+    Compression compression = NoCompression;
+    bool replace = false;
+};
+
+// Runs on worker thread, only payload and previous archive are touched
+static void compressFile(const QByteArray &payload, Compression from, ResourceTreeFile *old,
+                         const QList<Compression> &codecs, const Lilrcc::CompressionOptions &options, CompressJob &job) {
+    Lilrcc::Error error = Lilrcc::NoError;
+    QByteArray input = Lilrcc::uncompress(payload, from, error);
+    if (error != Lilrcc::NoError)
+        return;
+    if (old) {
+        // Reader of previous archive is safe to use from several threads
+        QByteArray oldPayload = old->getCompressed();
+        Lilrcc::Error oldError = Lilrcc::NoError;
+        if (Lilrcc::uncompress(oldPayload, old->getCompression(), oldError) == input && oldError == Lilrcc::NoError) {
+            job.compression = old->getCompression();
+            job.replace = job.compression != from;
+            if (job.replace)
+                job.result = oldPayload;
+            return;
+        }
+    }
+    // Compressed payload which meets threshold competes with new ones, so
+    // file never gets bigger. Otherwise it is stored raw like rcc would
+    bool keepStored = from != NoCompression && Lilrcc::meetsThreshold(input.size(), payload.size(), options.threshold);
+    qsizetype bestSize = keepStored ? payload.size() : -1;
+    for (Compression codec : codecs) {
+        QByteArray compressed = Lilrcc::compress(input, codec, options.level);
+        if (compressed.isNull() || !Lilrcc::meetsThreshold(input.size(), compressed.size(), options.threshold))
+            continue;
+        if (bestSize < 0 || compressed.size() < bestSize) {
+            job.result = compressed;
+            job.compression = codec;
+            job.replace = true;
+            bestSize = compressed.size();
+        }
+    }
+    if (!job.replace && from != NoCompression && !keepStored) {
+        job.result = input;
+        job.compression = NoCompression;
+        job.replace = true;
+    }
+}
+
+void ResourceLibrary::compress(const Lilrcc::CompressionOptions &options, ResourceLibrary *previous) {
+    compressTree(options, previous, false);
+}
+
+void ResourceLibrary::compressAdded(const Lilrcc::CompressionOptions &options) {
+    compressTree(options, nullptr, true);
+}
+
+void ResourceLibrary::compressTree(const Lilrcc::CompressionOptions &options, ResourceLibrary *previous, bool addedOnly) {
+    if (options.compression == NoCompression && !options.automatic)
+        return;
+    // Automatic mode tries both codecs on every file
+    QList<Compression> codecs;
+    if (options.automatic)
+        codecs << ZlibCompression << ZstdCompression;
+    else
+        codecs << options.compression;
+
+    // Files are read here, reader is not thread safe
+    QList<ResourceTreeDir*> candidateDirs;
+    QList<ResourceTreeFile*> candidates;
+    QList<ResourceTreeFile*> candidatePrevious;
+    QList<QPair<ResourceTreeDir*, QString>> pending;
+    pending << qMakePair(&m_root, QString());
+    if (previous)
+        previous->buildPathIndex();
+    while (!pending.isEmpty()) {
+        auto [dir, dirPath] = pending.takeFirst();
+        // Nothing was added to directory which was never loaded
+        if (addedOnly && !dir->childrenLoaded())
+            continue;
+        for (ResourceTreeNode *child : dir->children()) {
+            QString path = dirPath + "/" + child->name();
+            if (child->isDir()) {
+                pending << qMakePair(static_cast<ResourceTreeDir*>(child), path);
+                continue;
+            }
+            ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
+            if (addedOnly && dynamic_cast<RccResourceTreeFile*>(file))
+                continue;
+            // Compressed files are chosen codec again only in automatic mode
+            if (file->getCompression() != NoCompression && !options.automatic)
+                continue;
+            // Payload of previous archive can be taken only if it has codec
+            // which would be chosen now
+            Lilrcc::Error error = Lilrcc::NoError;
+            ResourceTreeFile *old = previous ? previous->getFileNode(path, error) : nullptr;
+            if (old && !options.automatic && old->getCompression() != options.compression)
+                old = nullptr;
+            candidateDirs << dir;
+            candidates << file;
+            candidatePrevious << old;
+        }
+    }
+    // Every file is one job, payloads are read in batches and at most
+    // 2*jobs of them are decompressed at once, so inputs never pile up
+    int jobs = qMax(1, options.jobs);
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    QSemaphore inFlight(2*jobs);
+    QList<CompressJob> results(candidates.size());
+    CompressJob *jobResults = results.data();
+    qsizetype batchStart = 0;
+    while (batchStart < candidates.size()) {
+        qsizetype batchEnd = batchStart;
+        qint64 batchBytes = 0;
+        while (batchEnd < candidates.size() && batchEnd - batchStart < Lilrcc::ioQueueDepth() && batchBytes < maxBatchBytes)
+            batchBytes += candidates.at(batchEnd++)->dataSize();
+        QList<ResourceTreeFile*> batch = candidates.mid(batchStart, batchEnd - batchStart);
+        QList<QByteArray> stored = readStored(batch);
+        for (qsizetype i = 0; i < batch.size(); i++) {
+            QByteArray payload = stored.at(i);
+            Compression from = batch.at(i)->getCompression();
+            ResourceTreeFile *old = candidatePrevious.at(batchStart + i);
+            CompressJob *job = jobResults + batchStart + i;
+            inFlight.acquire();
+            pool.start([payload, from, old, &codecs, &options, job, &inFlight]() {
+                compressFile(payload, from, old, codecs, options, *job);
+                inFlight.release();
+            });
+        }
+        batchStart = batchEnd;
+    }
+    pool.waitForDone();
+
+    invalidatePathIndex();
+    // Results are applied in tree order, so writer gets them in order too
+    for (qsizetype i = 0; i < candidates.size(); i++) {
+        CompressJob &job = results[i];
+        if (!job.replace)
+            continue;
+        ResourceTreeFile *file = candidates.at(i);
+        ResourceTreeFile *replacement = new QByteArrayResourceTreeFile(file->name(), file->nameHash(), job.result, job.compression);
+        replacement->setLastModified(file->lastModified());
+        job.result = QByteArray();
+        // Replaces and deletes old file with the same name
+        candidateDirs.at(i)->insertChild(replacement);
+    }
+}
+
+// Files decompressed to bigger size are extracted in chunks, files stored
+// bigger are streamed by workers instead of being read ahead
+static const qint64 maxExtractBuffer = 16*1024*1024;
+
+// Writes file to path from its stored payload, or if streamed straight
+// from the file in chunks
+static Lilrcc::Error extractFile(ResourceTreeFile *file, bool streamed, const QByteArray &payload, Compression compression, const QString &path) {
+    Lilrcc::Error error = Lilrcc::NoError;
+    QFile out(path);
+    if (!out.open(QIODeviceBase::WriteOnly))
+        return Lilrcc::CannotWriteFile;
+    bool writeFailed = false;
+    auto sink = [&out, &writeFailed](const char *chunk, qsizetype size) {
+        writeFailed = out.write(chunk, size) != size;
+        return !writeFailed;
+    };
+    qint64 size = streamed ? -1 : Lilrcc::uncompressedSize(payload, compression);
+    if (streamed) {
+        file->readChunks(sink, error);
+    } else if (size < 0 || size > maxExtractBuffer) {
+        // Big files go to disk in chunks, so memory stays bounded
+        Lilrcc::uncompressChunks(payload, compression, sink, error);
+    } else {
+        // Every worker thread reuses its own buffer
+        static thread_local QByteArray data;
+        if (Lilrcc::uncompress(payload, compression, data, error) && out.write(data) != data.size())
+            writeFailed = true;
+    }
+    return writeFailed ? Lilrcc::CannotWriteFile : error;
+}
+
+bool ResourceLibrary::extract(QString outDir, int jobs, Lilrcc::Error &error) {
+    jobs = qMax(1, jobs);
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    // Limits how many decompressed files are kept in memory at once
+    QSemaphore inFlight(2*jobs);
+    QAtomicInt firstError = Lilrcc::NoError;
+    auto startFile = [&](ResourceTreeFile *file, bool streamed, const QByteArray &payload, const QString &path) {
+        Compression compression = file->getCompression();
+        inFlight.acquire();
+        pool.start([file, streamed, payload, compression, path, &inFlight, &firstError]() {
+            Lilrcc::Error fileError = extractFile(file, streamed, payload, compression, path);
+            if (fileError != Lilrcc::NoError)
+                firstError.testAndSetRelaxed(Lilrcc::NoError, fileError);
+            inFlight.release();
+        });
+    };
+
+    // Small files are read in batches, next batch is read while workers
+    // decompress previous one
+    QList<ResourceTreeFile*> batchFiles;
+    QStringList batchPaths;
+    qint64 batchBytes = 0;
+    auto extractBatch = [&]() {
+        QList<QByteArray> payloads = readStored(batchFiles);
+        for (qsizetype i = 0; i < batchFiles.size(); i++)
+            startFile(batchFiles.at(i), false, payloads.at(i), batchPaths.at(i));
+        batchFiles.clear();
+        batchPaths.clear();
+        batchBytes = 0;
+    };
+
+    QList<QPair<ResourceTreeDir*, QString>> pending;
+    pending << qMakePair(&m_root, QDir(outDir).absolutePath());
+    while (!pending.isEmpty() && firstError.loadRelaxed() == Lilrcc::NoError) {
+        auto [dir, dirPath] = pending.takeFirst();
+        if (!QDir().mkpath(dirPath)) {
+            firstError.testAndSetRelaxed(Lilrcc::NoError, Lilrcc::CannotWriteFile);
+            break;
+        }
+        for (ResourceTreeNode *child : dir->children()) {
+            QString name = child->name();
+            // Never let entry escape output directory
+            if (name.isEmpty() || name == "." || name == ".." || name.contains('/'))
+                continue;
+            QString path = dirPath + "/" + name;
+            if (child->isDir()) {
+                pending << qMakePair(static_cast<ResourceTreeDir*>(child), path);
+                continue;
+            }
+            ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
+            quint32 size = file->dataSize();
+            if (size > maxExtractBuffer) {
+                startFile(file, true, QByteArray(), path);
+                continue;
+            }
+            batchFiles << file;
+            batchPaths << path;
+            batchBytes += size;
+            if (batchFiles.size() >= Lilrcc::ioQueueDepth() || batchBytes >= maxBatchBytes)
+                extractBatch();
+        }
+    }
+    // Directories of files in last batch are already created
+    if (firstError.loadRelaxed() == Lilrcc::NoError)
+        extractBatch();
+    pool.waitForDone();
+
+    error = Lilrcc::Error(firstError.loadRelaxed());
+    return error == Lilrcc::NoError;
+}
+
+// Stored data of files, ones from library's reader are read in one batch
+QList<QByteArray> ResourceLibrary::readStored(const QList<ResourceTreeFile*> &files) {
+    QList<QByteArray> data(files.size());
+    QList<quint32> dataOffsets;
+    QList<qsizetype> indexes;
+    for (qsizetype i = 0; i < files.size(); i++) {
+        RccResourceTreeFile *rccFile = dynamic_cast<RccResourceTreeFile*>(files.at(i));
+        if (rccFile && rccFile->reader() == m_reader) {
+            dataOffsets << rccFile->dataOffset();
+            indexes << i;
+        } else {
+            data[i] = files.at(i)->getCompressed();
+        }
+    }
+    QList<QByteArray> batch = m_reader->readDataBatch(dataOffsets);
+    for (qsizetype i = 0; i < indexes.size(); i++)
+        data[indexes.at(i)] = batch.at(i);
+    return data;
+}
+
+struct MergeState {
+    bool lastWins;
+    QString conflict;
+    Lilrcc::Error error = Lilrcc::NoError;
+};
+
+static void mergeDirs(ResourceTreeDir *into, ResourceTreeDir *from, const QString &path, MergeState &state);
+
+// Returns node which stays in merged tree, other one is deleted
+static ResourceTreeNode *mergeNodes(ResourceTreeNode *left, ResourceTreeNode *right, const QString &path, MergeState &state) {
+    if (left->isDir() && right->isDir()) {
+        mergeDirs(static_cast<ResourceTreeDir*>(left), static_cast<ResourceTreeDir*>(right), path, state);
+        delete right;
+        return left;
+    }
+    if (!left->isDir() && !right->isDir()) {
+        // Identical files are not a conflict
+        ResourceTreeFile *leftFile = static_cast<ResourceTreeFile*>(left);
+        ResourceTreeFile *rightFile = static_cast<ResourceTreeFile*>(right);
+        if (leftFile->dataSize() == rightFile->dataSize()
+            && leftFile->getCompression() == rightFile->getCompression()
+            && leftFile->getCompressed() == rightFile->getCompressed()) {
+            delete right;
+            return left;
+        }
+    }
+    if (state.lastWins) {
+        delete left;
+        return right;
+    }
+    if (state.error == Lilrcc::NoError) {
+        state.error = Lilrcc::EntryConflict;
+        state.conflict = path;
+    }
+    delete right;
+    return left;
+}
+
+// Children of both dirs are sorted by hash, so they are merged like in
+// merge sort. Nodes are moved from one tree to another, dirs only one side
+// has are not even loaded
+static void mergeDirs(ResourceTreeDir *into, ResourceTreeDir *from, const QString &path, MergeState &state) {
+    QList<ResourceTreeNode*> left = into->takeChildren();
+    QList<ResourceTreeNode*> right = from->takeChildren();
+    QList<ResourceTreeNode*> merged;
+    merged.reserve(left.size() + right.size());
+    qsizetype l = 0;
+    qsizetype r = 0;
+    while (l < left.size() && r < right.size()) {
+        quint32 leftHash = left.at(l)->nameHash();
+        quint32 rightHash = right.at(r)->nameHash();
+        if (leftHash < rightHash) {
+            merged << left.at(l++);
+            continue;
+        }
+        if (rightHash < leftHash) {
+            merged << right.at(r++);
+            continue;
+        }
+        // Different names may have the same hash, runs of it are matched by name
+        qsizetype leftEnd = l;
+        while (leftEnd < left.size() && left.at(leftEnd)->nameHash() == leftHash)
+            leftEnd++;
+        qsizetype rightEnd = r;
+        while (rightEnd < right.size() && right.at(rightEnd)->nameHash() == rightHash)
+            rightEnd++;
+        for (; l < leftEnd; l++) {
+            ResourceTreeNode *node = left.at(l);
+            for (qsizetype i = r; i < rightEnd; i++) {
+                if (right.at(i) && right.at(i)->name() == node->name()) {
+                    node = mergeNodes(node, right.at(i), path + "/" + node->name(), state);
+                    right[i] = nullptr;
+                    break;
+                }
+            }
+            merged << node;
+        }
+        for (; r < rightEnd; r++) {
+            if (right.at(r))
+                merged << right.at(r);
+        }
+    }
+    merged << left.mid(l) << right.mid(r);
+    into->setChildren(merged);
+}
+
+bool ResourceLibrary::merge(ResourceLibrary *other, bool lastWins, QString &conflict, Lilrcc::Error &error) {
+    invalidatePathIndex();
+    other->invalidatePathIndex();
+    MergeState state;
+    state.lastWins = lastWins;
+    mergeDirs(&m_root, &other->m_root, "", state);
+    error = state.error;
+    conflict = state.conflict;
+    return error == Lilrcc::NoError;
+}
+
+struct DiffState {
+    QList<ResourceDifference> differences;
+    // Candidates for moves
+    QList<QPair<QString, ResourceTreeFile*>> removed;
+    QList<QPair<QString, ResourceTreeFile*>> added;
+    Lilrcc::Error error = Lilrcc::NoError;
+};
+
+// Collects all files under node, only metadata is read
+static void collectFiles(ResourceTreeNode *node, const QString &path, QList<QPair<QString, ResourceTreeFile*>> &files) {
+    if (!node->isDir()) {
+        files << qMakePair(path, static_cast<ResourceTreeFile*>(node));
+        return;
+    }
+    for (ResourceTreeNode *child : static_cast<ResourceTreeDir*>(node)->children())
+        collectFiles(child, path + "/" + child->name(), files);
+}
+
+static bool sameFiles(ResourceTreeFile *left, ResourceTreeFile *right, Lilrcc::Error &error) {
+    if (left->getCompression() == right->getCompression())
+        return left->dataSize() == right->dataSize() && left->getCompressed() == right->getCompressed();
+    // Same content may be stored with other codec
+    QByteArray leftData = left->read(error);
+    QByteArray rightData = right->read(error);
+    return leftData == rightData;
+}
+
+static void diffNodes(ResourceTreeNode *left, ResourceTreeNode *right, const QString &path, DiffState &state);
+
+// Children of both dirs are sorted by hash, so they are walked in lockstep
+static void diffDirs(ResourceTreeDir *left, ResourceTreeDir *right, const QString &path, DiffState &state) {
+    const QList<ResourceTreeNode*> &leftChildren = left->children();
+    const QList<ResourceTreeNode*> &rightChildren = right->children();
+    qsizetype l = 0;
+    qsizetype r = 0;
+    while (l < leftChildren.size() || r < rightChildren.size()) {
+        if (r == rightChildren.size() || (l < leftChildren.size() && leftChildren.at(l)->nameHash() < rightChildren.at(r)->nameHash())) {
+            collectFiles(leftChildren.at(l), path + "/" + leftChildren.at(l)->name(), state.removed);
+            l++;
+            continue;
+        }
+        if (l == leftChildren.size() || rightChildren.at(r)->nameHash() < leftChildren.at(l)->nameHash()) {
+            collectFiles(rightChildren.at(r), path + "/" + rightChildren.at(r)->name(), state.added);
+            r++;
+            continue;
+        }
+        // Different names may have the same hash, runs of it are matched by name
+        quint32 hash = leftChildren.at(l)->nameHash();
+        qsizetype leftEnd = l;
+        while (leftEnd < leftChildren.size() && leftChildren.at(leftEnd)->nameHash() == hash)
+            leftEnd++;
+        qsizetype rightEnd = r;
+        while (rightEnd < rightChildren.size() && rightChildren.at(rightEnd)->nameHash() == hash)
+            rightEnd++;
+        qsizetype rightStart = r;
+        QList<bool> matched(rightEnd - rightStart, false);
+        for (; l < leftEnd; l++) {
+            ResourceTreeNode *node = leftChildren.at(l);
+            QString childPath = path + "/" + node->name();
+            qsizetype i = r;
+            while (i < rightEnd && (matched.at(i - rightStart) || rightChildren.at(i)->name() != node->name()))
+                i++;
+            if (i == rightEnd) {
+                collectFiles(node, childPath, state.removed);
+                continue;
+            }
+            matched[i - rightStart] = true;
+            diffNodes(node, rightChildren.at(i), childPath, state);
+        }
+        for (; r < rightEnd; r++) {
+            if (!matched.at(r - rightStart))
+                collectFiles(rightChildren.at(r), path + "/" + rightChildren.at(r)->name(), state.added);
+        }
+    }
+}
+
+static void diffNodes(ResourceTreeNode *left, ResourceTreeNode *right, const QString &path, DiffState &state) {
+    if (left->isDir() && right->isDir()) {
+        diffDirs(static_cast<ResourceTreeDir*>(left), static_cast<ResourceTreeDir*>(right), path, state);
+        return;
+    }
+    if (left->isDir() || right->isDir()) {
+        collectFiles(left, path, state.removed);
+        collectFiles(right, path, state.added);
+        return;
+    }
+    Lilrcc::Error error = Lilrcc::NoError;
+    if (!sameFiles(static_cast<ResourceTreeFile*>(left), static_cast<ResourceTreeFile*>(right), error))
+        state.differences << ResourceDifference{ResourceDifference::Modified, path, {}};
+    if (error != Lilrcc::NoError)
+        state.error = error;
+}
+
+QList<ResourceDifference> ResourceLibrary::diff(ResourceLibrary *other, Lilrcc::Error &error) {
+    DiffState state;
+    diffDirs(&m_root, &other->m_root, "", state);
+
+    // Added file with the same payload as removed one was moved. Payload
+    // fingerprints find candidates, bytes are compared to be sure
+    QMultiHash<size_t, qsizetype> addedPayloads;
+    for (qsizetype i = 0; i < state.added.size(); i++) {
+        ResourceTreeFile *file = state.added.at(i).second;
+        addedPayloads.insert(qHash(file->getCompressed(), file->getCompression()), i);
+    }
+    QList<bool> moved(state.added.size(), false);
+    for (const auto &[path, file] : std::as_const(state.removed)) {
+        QByteArray payload = file->getCompressed();
+        bool found = false;
+        for (qsizetype i : addedPayloads.values(qHash(payload, file->getCompression()))) {
+            ResourceTreeFile *candidate = state.added.at(i).second;
+            if (moved.at(i) || candidate->getCompression() != file->getCompression() || candidate->getCompressed() != payload)
+                continue;
+            moved[i] = true;
+            found = true;
+            state.differences << ResourceDifference{ResourceDifference::Moved, state.added.at(i).first, path};
+            break;
+        }
+        if (!found)
+            state.differences << ResourceDifference{ResourceDifference::Removed, path, {}};
+    }
+    for (qsizetype i = 0; i < state.added.size(); i++) {
+        if (!moved.at(i))
+            state.differences << ResourceDifference{ResourceDifference::Added, state.added.at(i).first, {}};
+    }
+
+    // Walk goes in hash order, paths are easier to read sorted
+    std::sort(state.differences.begin(), state.differences.end(), [](const ResourceDifference &a, const ResourceDifference &b) {
+        return a.path < b.path;
+    });
+    error = state.error;
+    return state.differences;
+}
+
 void ResourceLibrary::save(ResourceWriter *writer) {
     writer->write(&m_root, 3);
 }
 
+void ResourceLibrary::saveInPlace(ResourceWriter *writer) {
+    writer->append(&m_root, m_reader);
+}
+
 QString tab = "";
 void ResourceLibrary::printDirTree(ResourceTreeDir *rootNode, QTextStream &out) {
     QList<ResourceTreeNode*> nodes = rootNode->children();
@@ -130,9 +735,10 @@ void ResourceLibrary::printDirTree(ResourceTreeDir *rootNode, QTextStream &out)
             printDirTree(static_cast<ResourceTreeDir*>(node), out);
             tab.chop(4);
         } else {
-            if (dynamic_cast<ZlibResourceTreeFile*>(node))
+            Compression compr = static_cast<ResourceTreeFile*>(node)->getCompression();
+            if (compr == ZlibCompression)
                 out << " -zlib";
-            if (dynamic_cast<ZstdResourceTreeFile*>(node))
+            if (compr == ZstdCompression)
                 out << " -zstd";
             out << "\n";
         }
@@ -145,31 +751,38 @@ QStringList ResourceLibrary::parsePath(QString path) {
     return path.split('/', Qt::SkipEmptyParts);
 }
 
-// uses binary search for fast finding child node with specified hash
-ResourceTreeNode *ResourceLibrary::binSearchNode(QList<ResourceTreeNode*> children, quint32 searchHash) {
-    if (children.isEmpty())
-        return nullptr;
-
-    int childrenCount = children.size();
-    int firstChild = 0;
-
-    ResourceTreeNode *node = children.at(firstChild+childrenCount/2);
-    while (searchHash != node->nameHash()) {
-        if (childrenCount == 1)
-            return nullptr;
+// uses binary search for fast finding child node with specified name, children
+// are sorted by name hash, and different names may have the same hash
+ResourceTreeNode *ResourceLibrary::binSearchNode(const QList<ResourceTreeNode*> &children, const QString &name) {
+    quint32 searchHash = qt_hash(name);
+    auto it = std::lower_bound(children.begin(), children.end(), searchHash,
+                               [](ResourceTreeNode *child, quint32 hash) { return child->nameHash() < hash; });
+    for (; it != children.end() && (*it)->nameHash() == searchHash; ++it) {
+        if ((*it)->name() == name)
+            return *it;
+    }
+    return nullptr;
+}
 
-        if (searchHash < node->nameHash())
-            childrenCount /= 2;
-        else {
-            firstChild += childrenCount/2;
-            childrenCount -= childrenCount/2;
-        }
-        node = children.at(firstChild+childrenCount/2);
+ResourceTreeFile *ResourceLibrary::getFileNode(QString path, Lilrcc::Error &error) {
+    ResourceTreeNode *node = getNode(parsePath(path), error);
+    if (error != Lilrcc::NoError) return nullptr;
+    if (node->isDir()) {
+        error = Lilrcc::GotFileInsteadOfDir;
+        return nullptr;
     }
-    return node;
+    return static_cast<ResourceTreeFile*>(node);
 }
 
 ResourceTreeNode *ResourceLibrary::getNode(QStringList path, Lilrcc::Error &error) {
+    error = Lilrcc::NoError;
+    if (m_pathIndexBuilt) {
+        // QHash compares whole path, so hit is always right entry
+        ResourceTreeNode *node = m_pathIndex.value(path.join('/'));
+        if (node)
+            return node;
+        // Walk tree anyway to find out what error is
+    }
     ResourceTreeNode *node = &m_root;
     for (QString &segment : path) {
         if (!node->isDir()) {
@@ -177,7 +790,7 @@ ResourceTreeNode *ResourceLibrary::getNode(QStringList path, Lilrcc::Error &erro
             return nullptr;
         }
         ResourceTreeDir *dir = static_cast<ResourceTreeDir*>(node);
-        node = binSearchNode(dir->children(), qt_hash(segment));
+        node = binSearchNode(dir->children(), segment);
         if (!node) {
             error = Lilrcc::EntryNotFound;
             return nullptr;
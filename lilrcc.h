@@ -1,12 +1,27 @@
 #ifndef LILRCC_H
 #define LILRCC_H
 
+#include "compression.h"
 #include "resourcereader.h"
 #include "resourcewriter.h"
 #include "tree.h"
 
 #include <QTextStream>
 #include <QString>
+#include <QHash>
+
+struct ResourceDifference {
+    enum Kind {
+        Added,
+        Removed,
+        Modified,
+        Moved
+    };
+    Kind kind;
+    QString path;
+    // Old path of moved file
+    QString oldPath;
+};
 
 class ResourceLibrary {
 public:
@@ -14,21 +29,71 @@ public:
 
     void printTree(QTextStream &out);
     QList<QString> ls(QString path, Lilrcc::Error &error);
+    // Short description of entry, its type, compression and size in archive
+    QString stat(QString path, Lilrcc::Error &error);
     QByteArray getFile(QString path, Lilrcc::Error &error);
+    // Passes file to sink in chunks instead of returning it whole
+    bool readFile(QString path, const Lilrcc::ChunkSink &sink, Lilrcc::Error &error);
+    // Writes file to device, uncompressed ones are copied inside the kernel
+    // when both archive and device are files, pipes or sockets
+    bool writeFile(QString path, QIODevice *device, Lilrcc::Error &error);
+    // length bytes of file from offset, uncompressed files read only them
+    QByteArray readRange(QString path, qint64 offset, qint64 length, Lilrcc::Error &error);
+    // Reads many files at once into memory through full path index,
+    // errors has error for every path. For callers resolving lots of
+    // small files, cat streams every file with writeFile instead
+    QList<QByteArray> getFiles(const QStringList &paths, QList<Lilrcc::Error> &errors);
+    // Index of every entry by full path, makes lookups O(1). Built by
+    // getFiles or by callers like cat with many paths before their
+    // lookups, dropped when tree changes
+    void buildPathIndex();
+    // Node of file at path, nullptr and error if there is none
+    ResourceTreeFile *getFileNode(QString path, Lilrcc::Error &error);
     bool rmFile(QString path, Lilrcc::Error &error);
     bool mvFile(QString source, QString dest, Lilrcc::Error &error);
     bool addFile(QByteArray data, QString name, QString dest, Lilrcc::Error &error);
+    // Compresses uncompressed files on options.jobs threads, file is
+    // replaced only if compressed data saves options.threshold percent.
+    // In automatic mode every file gets smallest codec, compressed payload
+    // it already has included, or is stored raw if none saves enough.
+    // Files with the same path and content in previous archive take its
+    // payload instead of being compressed again. Level and threshold are
+    // not checked for them and automatic mode keeps codec previous archive
+    // has, options payload was made with are not recorded in archive
+    void compress(const Lilrcc::CompressionOptions &options, ResourceLibrary *previous = nullptr);
+    // Same for files added to library only, files of archive are kept as
+    // they are and directories not loaded yet are not even walked
+    void compressAdded(const Lilrcc::CompressionOptions &options);
+    // Unpacks whole tree into outDir, decompressing on jobs threads
+    bool extract(QString outDir, int jobs, Lilrcc::Error &error);
+    // Moves whole tree of other into this one, other is left empty. Same
+    // files are replaced by ones from other if lastWins, otherwise error is
+    // set and first conflicting path is stored in conflict. Data is never
+    // decompressed, other's reader should live until this library is saved
+    bool merge(ResourceLibrary *other, bool lastWins, QString &conflict, Lilrcc::Error &error);
+    // Files which differ in other, payloads are compared compressed and
+    // decompressed only when codecs differ. Removed and added files with
+    // the same payload are reported as moved
+    QList<ResourceDifference> diff(ResourceLibrary *other, Lilrcc::Error &error);
     void save(ResourceWriter *writer);
+    // Appends changes to archive library was read from, see ResourceWriter::append
+    void saveInPlace(ResourceWriter *writer);
 
 private:
     void printDirTree(ResourceTreeDir *rootNode, QTextStream &out);
 
     static QStringList parsePath(QString path);
 
-    ResourceTreeNode *binSearchNode(QList<ResourceTreeNode*> children, quint32 searchHash);
+    ResourceTreeNode *binSearchNode(const QList<ResourceTreeNode*> &children, const QString &name);
     ResourceTreeNode *getNode(QStringList path, Lilrcc::Error &error);
+    QList<QByteArray> readStored(const QList<ResourceTreeFile*> &files);
+    void compressTree(const Lilrcc::CompressionOptions &options, ResourceLibrary *previous, bool addedOnly);
+    void invalidatePathIndex();
 
+    ResourceReader *m_reader;
     ResourceTreeDir m_root;
+    QHash<QString, ResourceTreeNode*> m_pathIndex;
+    bool m_pathIndexBuilt;
 };
 
 #endif // LILRCC_H
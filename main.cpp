@@ -1,21 +1,223 @@
 // This code is part of lilrcc project -> https://gitlab.com/pp2e/lilrcc
+#include "fileio.h"
 #include "lilrcc.h"
+#include "patch.h"
+#include "qrc.h"
 #include "resourcereader.h"
+#include "resourceserver.h"
 #include "resourcewriter.h"
+#include "stats.h"
 #include "tree.h"
 
 #include <QCoreApplication>
 #include <QCommandLineParser>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QProcess>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QScopedPointer>
+#include <QThread>
 
 using namespace Qt::StringLiterals;
 
+// Set from --stats, counters are printed on every exit, failed ones too
+static bool statsRequested = false;
+static bool statsJson = false;
+
+static void printRequestedStats() {
+    if (!statsRequested)
+        return;
+    QTextStream err(stderr);
+    Lilrcc::printStats(err, statsJson);
+}
+
 #define ASSERT(cond, message) if (!(cond)) {\
     qCritical() << message;\
+    printRequestedStats();\
     exit(1);\
 }\
 
+// Runs commands from script on one library, one command per line.
+// Stops at first failed command
+static bool runBatch(ResourceLibrary &lillib, QIODevice *script) {
+    QTextStream in(script);
+    QString line;
+    int lineNumber = 0;
+    while (in.readLineInto(&line)) {
+        lineNumber++;
+        line = line.trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        // Paths with spaces can be quoted
+        QStringList command = QProcess::splitCommand(line);
+        if (command.isEmpty())
+            continue;
+        QString action = command.takeFirst();
+        Lilrcc::Error error = Lilrcc::NoError;
+        if (action == "rm" && command.size() == 1) {
+            lillib.rmFile(command[0], error);
+        } else if (action == "mv" && command.size() == 2) {
+            lillib.mvFile(command[0], command[1], error);
+        } else if (action == "add" && command.size() == 2) {
+            QFile addFile(command[0]);
+            if (!addFile.open(QIODeviceBase::ReadOnly)) {
+                qCritical() << "Line" << lineNumber << "cannot open" << command[0];
+                return false;
+            }
+            lillib.addFile(addFile.readAll(), QFileInfo(command[0]).fileName(), command[1], error);
+        } else if (action == "cat" && command.size() == 2) {
+            QByteArray data = lillib.getFile(command[0], error);
+            if (error == Lilrcc::NoError) {
+                QFile outFile(command[1]);
+                if (!outFile.open(QIODeviceBase::WriteOnly) || outFile.write(data) != data.size())
+                    error = Lilrcc::CannotWriteFile;
+            }
+        } else if (action == "ls" && command.size() <= 1) {
+            QList<QString> entries = lillib.ls(command.value(0, "/"), error);
+            if (error == Lilrcc::NoError)
+                qInfo().noquote() << entries.join("\n");
+        } else {
+            qCritical() << "Line" << lineNumber << "unknown command" << line;
+            return false;
+        }
+        if (error != Lilrcc::NoError) {
+            qCritical() << "Line" << lineNumber << "failed" << line;
+            printError(error);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Archive opened for reading, library needs file and reader to stay alive
+struct OpenedArchive {
+    QFile file;
+    QScopedPointer<ResourceReader> reader;
+    QScopedPointer<ResourceLibrary> library;
+};
+
+// Prints why archive cannot be read and returns false
+static bool openArchive(const QString &fileName, OpenedArchive &archive) {
+    archive.file.setFileName(fileName);
+    ASSERT(archive.file.open(QIODeviceBase::ReadOnly), "Cannot open" << fileName)
+    archive.reader.reset(new ResourceReader(&archive.file));
+    if (archive.reader->error() != Lilrcc::NoError) {
+        qCritical() << "Cannot read" << fileName;
+        printError(archive.reader->error());
+        return false;
+    }
+    archive.library.reset(new ResourceLibrary(archive.reader.data()));
+    return true;
+}
+
+// Builds archive laid out like rcc does from qrcFile and writes it to
+// outFile with its manifest
+static int runCreate(const QString &outFile, const QString &qrcFile, const Lilrcc::CompressionOptions &options, const QString &reuseFile) {
+    // rcc lays data out in QHash order, so hashes are seeded like in rcc
+    QHashSeed::setDeterministicGlobalSeed();
+    // Previous archive must stay open until new one is written
+    Lilrcc::QrcReuse reuse;
+    OpenedArchive previous;
+    if (!reuseFile.isEmpty()) {
+        if (!openArchive(reuseFile, previous))
+            return 1;
+        reuse.library = previous.library.data();
+        if (!Lilrcc::readManifest(reuseFile + ".manifest", reuse.manifest))
+            qWarning() << "Cannot read" << reuseFile + ".manifest" << "every file will be compressed";
+    }
+
+    ResourceTreeDir root(":", 0);
+    QList<ResourceTreeNode*> insertionOrder;
+    Lilrcc::QrcManifest manifest;
+    int reused = 0;
+    QString failed;
+    Lilrcc::Error error = Lilrcc::NoError;
+    if (!Lilrcc::buildQrc(qrcFile, options, reuse, &root, insertionOrder, manifest, reused, failed, error)) {
+        qCritical() << "Cannot add" << failed;
+        printError(error);
+        return 1;
+    }
+    if (!reuseFile.isEmpty())
+        qInfo() << "Reused" << reused << "of" << manifest.size() << "files";
+    QSaveFile out(outFile);
+    if (out.open(QIODeviceBase::WriteOnly)) {
+        ResourceWriter writer(&out);
+        writer.setRccLayout(insertionOrder);
+        writer.write(&root, 3);
+        if (writer.error() != Lilrcc::NoError) {
+            printError(writer.error());
+            return 1;
+        }
+    }
+    if (!out.commit()) {
+        qCritical() << "Cannot write" << outFile;
+        return 1;
+    }
+    // Next build reuses payloads of this one through it
+    ASSERT(Lilrcc::writeManifest(outFile + ".manifest", manifest), "Cannot write" << outFile + ".manifest")
+    return 0;
+}
+
+// Merges archives in given order into new one written to outFile
+static int runMerge(const QString &outFile, const QStringList &inputs, bool lastWins, bool deduplicate) {
+    QList<QFile*> files;
+    QList<ResourceReader*> readers;
+    QList<ResourceLibrary*> libraries;
+    int result = 0;
+    for (const QString &input : inputs) {
+        QFile *file = new QFile(input);
+        files << file;
+        if (!file->open(QIODeviceBase::ReadOnly)) {
+            qCritical() << "Cannot open" << input;
+            result = 1;
+            break;
+        }
+        ResourceReader *reader = new ResourceReader(file);
+        readers << reader;
+        if (reader->error() != Lilrcc::NoError) {
+            qCritical() << "Cannot read" << input;
+            printError(reader->error());
+            result = 1;
+            break;
+        }
+        libraries << new ResourceLibrary(reader);
+        if (libraries.size() == 1)
+            continue;
+        QString conflict;
+        Lilrcc::Error error;
+        if (!libraries.first()->merge(libraries.last(), lastWins, conflict, error)) {
+            qCritical() << "Cannot merge" << input << "entry" << conflict;
+            printError(error);
+            result = 1;
+            break;
+        }
+    }
+    if (result == 0) {
+        // Payloads are copied from input archives as they are
+        QSaveFile merged(outFile);
+        if (merged.open(QIODeviceBase::WriteOnly)) {
+            ResourceWriter writer(&merged);
+            writer.setDeduplicate(deduplicate);
+            libraries.first()->save(&writer);
+            if (writer.error() != Lilrcc::NoError) {
+                printError(writer.error());
+                result = 1;
+            }
+        }
+        if (result == 0 && !merged.commit()) {
+            qCritical() << "Cannot write" << outFile;
+            result = 1;
+        }
+    }
+    // Merged tree lives in first library and uses all readers
+    qDeleteAll(libraries);
+    qDeleteAll(readers);
+    qDeleteAll(files);
+    return result;
+}
+
 int main(int argc, char *argv[]) {
     QCoreApplication app(argc, argv);
 
@@ -31,24 +233,153 @@ int main(int argc, char *argv[]) {
                                                                           "entries\n"
                                                                           "names\n"
                                                                           "ls [path]\n"
-                                                                          "cat <file>\n"
+                                                                          "cat <file> [<file>...]\n"
+                                                                          "range <file> <offset> <length>\n"
                                                                           "tree\n"
                                                                           "rm <file>\n"
                                                                           "mv <source> <dest>\n"
                                                                           "add <source> <dest>\n"
-                                                                          "repack\n"));
+                                                                          "repack\n"
+                                                                          "compact\n"
+                                                                          "batch <script|->\n"
+                                                                          "extract <outdir>\n"
+                                                                          "merge <archive> [<archive>...], <file> is created\n"
+                                                                          "diff <archive>\n"
+                                                                          "transcode --to <codec>\n"
+                                                                          "mkpatch <new archive> <patch>\n"
+                                                                          "applypatch <patch> <output>\n"
+                                                                          "serve --socket <path>\n"
+                                                                          "client --socket <path> cat|ls|stat <path>, used instead of <file>\n"
+                                                                          "create <archive> --qrc <file>, used instead of <file>, writes <archive>.manifest too\n"));
     parser.addPositionalArgument(QStringLiteral("[<args>]"), QStringLiteral("Arguments for command"));
 
-    parser.process(app);
+    QCommandLineOption compressOption(QStringLiteral("compress"), QStringLiteral("Compress uncompressed files on add, repack and create, <codec> is zlib, zstd or auto to pick smallest of them for every file"), QStringLiteral("codec"));
+    parser.addOption(compressOption);
+    QCommandLineOption levelOption(QStringLiteral("level"), QStringLiteral("Compression level, codec default if not set. zlib takes -1 to 9, zstd -1 to its maximum, auto only levels both take"), QStringLiteral("level"));
+    parser.addOption(levelOption);
+    QCommandLineOption toOption(QStringLiteral("to"), QStringLiteral("Codec transcode converts every file to, zlib, zstd or none"), QStringLiteral("codec"));
+    parser.addOption(toOption);
+    QCommandLineOption thresholdOption(QStringLiteral("threshold"), QStringLiteral("Percent of size compression should save to be kept, 70 by default for auto and 0 otherwise"), QStringLiteral("percent"));
+    parser.addOption(thresholdOption);
+    QCommandLineOption dedupOption(QStringLiteral("dedup"), QStringLiteral("Store identical files only once when saving"));
+    parser.addOption(dedupOption);
+    QCommandLineOption inPlaceOption(QStringLiteral("in-place"), QStringLiteral("Append changes of rm, mv, add, repack and batch to the file itself instead of writing new archive to stdout"));
+    parser.addOption(inPlaceOption);
+    QCommandLineOption jobsOption(QStringLiteral("j"), QStringLiteral("Number of threads to use"), QStringLiteral("jobs"));
+    parser.addOption(jobsOption);
+    QCommandLineOption socketOption(QStringLiteral("socket"), QStringLiteral("Local socket server listens on or client connects to"), QStringLiteral("path"));
+    parser.addOption(socketOption);
+    QCommandLineOption cacheSizeOption(QStringLiteral("cache-size"), QStringLiteral("Memory for decompressed files cached by server, 64 MiB by default"), QStringLiteral("MiB"));
+    parser.addOption(cacheSizeOption);
+    QCommandLineOption statsOption(QStringLiteral("stats"), QStringLiteral("Print reader, codec and writer counters to stderr at exit, --stats=json prints them as JSON"));
+    parser.addOption(statsOption);
+    QCommandLineOption conflictOption(QStringLiteral("on-conflict"), QStringLiteral("What merge does with entry existing in many archives, last wins by default or error"), QStringLiteral("policy"));
+    parser.addOption(conflictOption);
+    QCommandLineOption qrcOption(QStringLiteral("qrc"), QStringLiteral("Qrc file create builds archive from"), QStringLiteral("file"));
+    parser.addOption(qrcOption);
+    QCommandLineOption reuseOption(QStringLiteral("reuse"), QStringLiteral("Previous archive create and repack take payloads of unchanged files from instead of compressing them again, create also needs its .manifest. repack reuses payloads whatever level and threshold they were made with and does not pick codec again in auto mode"), QStringLiteral("archive"));
+    parser.addOption(reuseOption);
+    QCommandLineOption queueDepthOption(QStringLiteral("queue-depth"), QStringLiteral("Reads and writes kept in flight at once, 32 by default, 1 disables batching"), QStringLiteral("depth"));
+    parser.addOption(queueDepthOption);
+
+    // Parser has no optional values, so json format is taken out before
+    QStringList arguments = app.arguments();
+    for (QString &argument : arguments) {
+        if (argument == "--stats=json" || argument == "-stats=json") {
+            argument = "--stats";
+            statsJson = true;
+        }
+    }
+    parser.process(arguments);
+    statsRequested = parser.isSet(statsOption);
+    auto printStats = qScopeGuard(printRequestedStats);
+    if (parser.isSet(queueDepthOption)) {
+        bool ok;
+        int depth = parser.value(queueDepthOption).toInt(&ok);
+        ASSERT(ok && depth > 0, "Queue depth should be positive number")
+        Lilrcc::setIoQueueDepth(depth);
+    }
+
+    int jobs = QThread::idealThreadCount();
+    if (parser.isSet(jobsOption)) {
+        bool ok;
+        jobs = parser.value(jobsOption).toInt(&ok);
+        ASSERT(ok && jobs > 0, "Number of jobs should be positive number")
+    }
+    Lilrcc::CompressionOptions compression;
+    compression.jobs = jobs;
+    if (parser.isSet(compressOption)) {
+        QString codec = parser.value(compressOption);
+        if (codec == "zlib")
+            compression.compression = ZlibCompression;
+        else if (codec == "zstd")
+            compression.compression = ZstdCompression;
+        else if (codec == "auto") {
+            compression.automatic = true;
+            // Default of rcc
+            compression.threshold = 70;
+        } else
+            ASSERT(false, "Unknown codec" << codec << "please use zlib, zstd or auto")
+    }
+    if (parser.isSet(thresholdOption)) {
+        bool ok;
+        compression.threshold = parser.value(thresholdOption).toInt(&ok);
+        ASSERT(ok && compression.threshold >= 0 && compression.threshold <= 100, "Threshold should be number from 0 to 100")
+    }
+    if (parser.isSet(levelOption)) {
+        bool ok;
+        compression.level = parser.value(levelOption).toInt(&ok);
+        ASSERT(ok, "Compression level should be number")
+        // Auto mode passes the same level to both codecs
+        bool valid = compression.automatic ? Lilrcc::validLevel(ZlibCompression, compression.level) && Lilrcc::validLevel(ZstdCompression, compression.level)
+                                           : Lilrcc::validLevel(compression.compression, compression.level);
+        ASSERT(valid, "Compression level" << compression.level << "is not supported by codec, zlib has -1 to 9")
+    }
 
     QStringList args = parser.positionalArguments();
     if (args.isEmpty()) {
         qCritical() << "Please specify file";
         parser.showHelp(1);
     }
+    if (args.first() == "client") {
+        // Client talks to running server, there is no archive to open
+        ASSERT(parser.isSet(socketOption), "Please specify server socket with --socket")
+        ASSERT(args.size() >= 3, "Please specify cat, ls or stat and path after client")
+        ResourceServer::Command command;
+        if (args[1] == "cat")
+            command = ResourceServer::Cat;
+        else if (args[1] == "ls")
+            command = ResourceServer::Ls;
+        else if (args[1] == "stat")
+            command = ResourceServer::Stat;
+        else
+            ASSERT(false, "Unknown client command" << args[1])
+        Lilrcc::Error error = Lilrcc::NoError;
+        QByteArray answer = ResourceServer::request(parser.value(socketOption), command, args[2], error);
+        if (error != Lilrcc::NoError) {
+            printError(error);
+            return 1;
+        }
+        // Files may be binary, they are written as they are
+        QFile output;
+        ASSERT(output.open(fileno(stdout), QIODeviceBase::WriteOnly), "Cannot open stdout")
+        ASSERT(output.write(answer) == answer.size(), "Cannot write to stdout")
+        return 0;
+    }
+    if (args.first() == "create") {
+        // Archive is built from scratch, there is no archive to open
+        ASSERT(args.size() >= 2, "Please specify output archive after create")
+        ASSERT(parser.isSet(qrcOption), "Please specify qrc file with --qrc")
+        return runCreate(args[1], parser.value(qrcOption), compression, parser.value(reuseOption));
+    }
+    if (args.size() >= 2 && args[1] == "merge") {
+        ASSERT(args.size() >= 3, "Please specify archives to merge after merge option")
+        QString policy = parser.value(conflictOption);
+        ASSERT(policy.isEmpty() || policy == "last" || policy == "error", "Unknown conflict policy" << policy << "please use last or error")
+        return runMerge(args.first(), args.mid(2), policy != "error", parser.isSet(dedupOption));
+    }
     QString inFile = args.first();
-    QFile file(inFile);
-    if (!file.exists()) {
+    if (!QFile::exists(inFile)) {
         qCritical() << "File" << inFile << "does not exist";
         return 1;
     }
@@ -56,8 +387,13 @@ int main(int argc, char *argv[]) {
         qCritical() << "Please specity action";
         parser.showHelp(1);
     }
-    file.open(QIODeviceBase::ReadOnly);
-    ResourceReader reader(&file);
+
+    OpenedArchive archive;
+    if (!openArchive(inFile, archive))
+        return 1;
+    QFile &file = archive.file;
+    ResourceReader &reader = *archive.reader;
+    ResourceLibrary &lillib = *archive.library;
     QTextStream out(stdout);
     if (args[1] == "header") {
         reader.printHeader(out);
@@ -71,15 +407,57 @@ int main(int argc, char *argv[]) {
         reader.printNames(out);
         return 0;
     }
-    ResourceLibrary lillib(&reader);
+    auto save = [&]() {
+        QFile inPlace(inFile);
+        if (parser.isSet(inPlaceOption))
+            ASSERT(inPlace.open(QIODeviceBase::ReadWrite), "Cannot open" << inFile << "for writing")
+        ResourceWriter writer(inPlace.isOpen() ? &inPlace : out.device());
+        writer.setDeduplicate(parser.isSet(dedupOption));
+        if (inPlace.isOpen())
+            lillib.saveInPlace(&writer);
+        else
+            lillib.save(&writer);
+        if (writer.error() != Lilrcc::NoError) {
+            printError(writer.error());
+            return false;
+        }
+        if (parser.isSet(dedupOption))
+            qInfo() << "Deduplication saved" << writer.bytesSaved() << "bytes";
+        return true;
+    };
     if (args[1] == "cat") {
         ASSERT(args.size() >= 3, "Please specify path to file after cat option")
-        Lilrcc::Error error;
-        out << lillib.getFile(args[2], error);
+        // Many paths are resolved through full path index
+        if (args.size() > 3)
+            lillib.buildPathIndex();
+        // Uncompressed files go from archive to stdout inside the kernel,
+        // others are streamed in chunks straight from decompressor
+        QFile output;
+        ASSERT(output.open(fileno(stdout), QIODeviceBase::WriteOnly | QIODeviceBase::Unbuffered), "Cannot open stdout")
+        int result = 0;
+        for (const QString &path : args.mid(2)) {
+            Lilrcc::Error error = Lilrcc::NoError;
+            lillib.writeFile(path, &output, error);
+            if (error != Lilrcc::NoError) {
+                printError(error);
+                result = 1;
+            }
+        }
+        return result;
+    } else if (args[1] == "range") {
+        ASSERT(args.size() >= 5, "Please specify path, offset and length after range option")
+        bool offsetOk;
+        bool lengthOk;
+        qint64 offset = args[3].toLongLong(&offsetOk);
+        qint64 length = args[4].toLongLong(&lengthOk);
+        ASSERT(offsetOk && lengthOk && offset >= 0 && length >= 0, "Offset and length should be non-negative numbers")
+        Lilrcc::Error error = Lilrcc::NoError;
+        QByteArray range = lillib.readRange(args[2], offset, length, error);
         if (error != Lilrcc::NoError) {
             printError(error);
             return 1;
         }
+        out.device()->write(range);
     } else if (args[1] == "ls") {
         QString path = args.size() < 3 ? "/" : args[2];
         Lilrcc::Error error;
@@ -101,8 +479,8 @@ int main(int argc, char *argv[]) {
             printError(error);
             return 1;
         }
-        ResourceWriter writer(out.device());
-        lillib.save(&writer);
+        if (!save())
+            return 1;
     } else if (args[1] == "mv") {
         if (args.size() < 3) {
             qCritical() << "Please specify path to source entry after mv option\n";
@@ -118,8 +496,8 @@ int main(int argc, char *argv[]) {
             printError(error);
             return 1;
         }
-        ResourceWriter writer(out.device());
-        lillib.save(&writer);
+        if (!save())
+            return 1;
     } else if (args[1] == "add") {
         if (args.size() < 3) {
             qCritical() << "Please specify path to source file after add option\n";
@@ -144,11 +522,137 @@ int main(int argc, char *argv[]) {
             printError(error);
             return 1;
         }
-        ResourceWriter writer(out.device());
-        lillib.save(&writer);
+        lillib.compressAdded(compression);
+        if (!save())
+            return 1;
     } else if (args[1] == "repack") {
-        ResourceWriter writer(out.device());
+        // Files are compared with previous archive by content, so no
+        // manifest is needed. It must stay open until archive is saved
+        OpenedArchive previous;
+        if (parser.isSet(reuseOption) && !openArchive(parser.value(reuseOption), previous))
+            return 1;
+        lillib.compress(compression, previous.library.data());
+        if (!save())
+            return 1;
+    } else if (args[1] == "batch") {
+        ASSERT(args.size() >= 3, "Please specify script file or - for stdin after batch option")
+        QFile script(args[2]);
+        if (args[2] == "-")
+            script.open(stdin, QIODeviceBase::ReadOnly);
+        else
+            script.open(QIODeviceBase::ReadOnly);
+        ASSERT(script.isOpen(), "Cannot open script" << args[2])
+        if (!runBatch(lillib, &script))
+            return 1;
+        // Whole script result is written once, files it added compressed
+        lillib.compressAdded(compression);
+        if (!save())
+            return 1;
+    } else if (args[1] == "compact") {
+        // Rewrites archive without dead space left by in place edits
+        QSaveFile compacted(inFile);
+        ASSERT(compacted.open(QIODeviceBase::WriteOnly), "Cannot open" << inFile << "for writing")
+        ResourceWriter writer(&compacted);
+        writer.setDeduplicate(parser.isSet(dedupOption));
         lillib.save(&writer);
+        if (writer.error() != Lilrcc::NoError) {
+            printError(writer.error());
+            return 1;
+        }
+        ASSERT(compacted.commit(), "Cannot write" << inFile)
+    } else if (args[1] == "diff") {
+        ASSERT(args.size() >= 3, "Please specify archive to compare with after diff option")
+        OpenedArchive other;
+        if (!openArchive(args[2], other))
+            return 1;
+        Lilrcc::Error error;
+        QList<ResourceDifference> differences = lillib.diff(other.library.data(), error);
+        for (const ResourceDifference &difference : differences) {
+            switch (difference.kind) {
+            case ResourceDifference::Added:
+                out << "added: " << difference.path << "\n";
+                break;
+            case ResourceDifference::Removed:
+                out << "removed: " << difference.path << "\n";
+                break;
+            case ResourceDifference::Modified:
+                out << "modified: " << difference.path << "\n";
+                break;
+            case ResourceDifference::Moved:
+                out << "moved: " << difference.oldPath << " -> " << difference.path << "\n";
+                break;
+            }
+        }
+        if (error != Lilrcc::NoError) {
+            printError(error);
+            return 2;
+        }
+        // Like diff utility
+        return differences.isEmpty() ? 0 : 1;
+    } else if (args[1] == "transcode") {
+        ASSERT(parser.isSet(toOption), "Please specify codec with --to")
+        QString codec = parser.value(toOption);
+        Lilrcc::CompressionOptions options = compression;
+        if (codec == "zlib")
+            options.compression = ZlibCompression;
+        else if (codec == "zstd")
+            options.compression = ZstdCompression;
+        else if (codec == "none")
+            options.compression = NoCompression;
+        else
+            ASSERT(false, "Unknown codec" << codec << "please use zlib, zstd or none")
+        ASSERT(Lilrcc::validLevel(options.compression, options.level), "Compression level" << options.level << "is not supported by" << codec)
+        // Works on entries of reader, tree is not loaded
+        ResourceWriter writer(out.device());
+        Lilrcc::Error error = Lilrcc::NoError;
+        if (!writer.transcode(&reader, options, error)) {
+            printError(error);
+            return 1;
+        }
+    } else if (args[1] == "mkpatch") {
+        ASSERT(args.size() >= 4, "Please specify new archive and patch file after mkpatch option")
+        QFile newFile(args[2]);
+        ASSERT(newFile.open(QIODeviceBase::ReadOnly), "Cannot open" << args[2])
+        QSaveFile patch(args[3]);
+        ASSERT(patch.open(QIODeviceBase::WriteOnly), "Cannot open" << args[3] << "for writing")
+        Lilrcc::Error error = Lilrcc::NoError;
+        if (!Lilrcc::makePatch(&file, &newFile, &patch, error)) {
+            printError(error);
+            return 1;
+        }
+        ASSERT(patch.commit(), "Cannot write" << args[3])
+    } else if (args[1] == "applypatch") {
+        ASSERT(args.size() >= 4, "Please specify patch and output file after applypatch option")
+        QFile patch(args[2]);
+        ASSERT(patch.open(QIODeviceBase::ReadOnly), "Cannot open" << args[2])
+        // Output appears only if it matches archive patch was made from
+        QSaveFile output(args[3]);
+        ASSERT(output.open(QIODeviceBase::WriteOnly), "Cannot open" << args[3] << "for writing")
+        Lilrcc::Error error = Lilrcc::NoError;
+        if (!Lilrcc::applyPatch(&file, &patch, &output, error)) {
+            printError(error);
+            return 1;
+        }
+        ASSERT(output.commit(), "Cannot write" << args[3])
+    } else if (args[1] == "serve") {
+        ASSERT(parser.isSet(socketOption), "Please specify socket to listen on with --socket")
+        qint64 cacheSize = 64;
+        if (parser.isSet(cacheSizeOption)) {
+            bool ok;
+            cacheSize = parser.value(cacheSizeOption).toLongLong(&ok);
+            ASSERT(ok && cacheSize >= 0, "Cache size should be non-negative number of MiB")
+        }
+        ResourceServer server(&lillib, cacheSize*1024*1024);
+        ASSERT(server.listen(parser.value(socketOption)), "Cannot listen on" << parser.value(socketOption) << server.errorString())
+        return app.exec();
+    } else if (args[1] == "extract") {
+        ASSERT(args.size() >= 3, "Please specify output directory after extract option")
+        Lilrcc::Error error;
+        lillib.extract(args[2], jobs, error);
+        if (error != Lilrcc::NoError) {
+            printError(error);
+            return 1;
+        }
     } else {
         qCritical() << "Unknown action specified, please select smarter";
         parser.showHelp(1);
@@ -0,0 +1,216 @@
+#include "patch.h"
+#include "resourcereader.h"
+#include "tree.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QHash>
+
+#include <algorithm>
+
+// Patch is QDataStream of header and operations ending with EndOperation
+static const quint32 patchMagic = 0x6c726370; // "lrcp"
+static const quint32 patchVersion = 1;
+// Literals and copies are done in pieces of this size, so apply streams
+static const qint64 chunkSize = 1024*1024;
+
+enum PatchOperation : quint8 {
+    EndOperation = 0,
+    // quint64 offset in old archive, quint64 length
+    CopyOperation = 1,
+    // QByteArray with bytes of new archive
+    LiteralOperation = 2
+};
+
+// Raw payload, with its length, at offset in file
+struct PayloadBlock {
+    qint64 offset;
+    qint64 size;
+    quint32 dataOffset;
+};
+
+static QList<PayloadBlock> payloadBlocks(ResourceReader *reader, qint64 fileSize) {
+    QList<PayloadBlock> blocks;
+    for (quint32 i = 0; i < reader->entryCount(); i++) {
+        const ResourceEntry &entry = reader->entry(i);
+        if (entry.flags & Flags::Directory)
+            continue;
+        qint64 offset = qint64(reader->dataOffset()) + entry.dataOffset;
+        qint64 size = 4 + qint64(reader->readDataLength(entry.dataOffset));
+        if (offset + size > fileSize)
+            continue;
+        blocks << PayloadBlock{offset, size, entry.dataOffset};
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const PayloadBlock &a, const PayloadBlock &b) {
+        return a.offset < b.offset;
+    });
+    return blocks;
+}
+
+// Identifies old archive by its header fields and whole tree, without
+// reading payloads
+static QByteArray metadataDigest(ResourceReader *reader, qint64 size) {
+    QByteArray metadata;
+    QDataStream stream(&metadata, QIODeviceBase::WriteOnly);
+    stream << quint64(size) << reader->version() << reader->dataOffset() << reader->overallFlags();
+    for (quint32 i = 0; i < reader->entryCount(); i++) {
+        const ResourceEntry &entry = reader->entry(i);
+        stream << entry.nameOffset << entry.flags << entry.childrenCount << entry.firstChild << entry.lastModified;
+    }
+    return QCryptographicHash::hash(metadata, QCryptographicHash::Sha256);
+}
+
+static QByteArray fileDigest(QIODevice *device) {
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    device->seek(0);
+    hash.addData(device);
+    return hash.result();
+}
+
+static void writeLiteral(QDataStream &stream, QIODevice *device, qint64 from, qint64 to) {
+    device->seek(from);
+    while (from < to) {
+        qint64 size = qMin(chunkSize, to - from);
+        stream << quint8(LiteralOperation) << device->read(size);
+        from += size;
+    }
+}
+
+bool Lilrcc::makePatch(QIODevice *oldDevice, QIODevice *newDevice, QIODevice *patch, Error &error) {
+    ResourceReader oldReader(oldDevice);
+    ResourceReader newReader(newDevice);
+    if (oldReader.error() != NoError || newReader.error() != NoError) {
+        error = InputFileIsNotRcc;
+        return false;
+    }
+    qint64 oldSize = oldDevice->size();
+    qint64 newSize = newDevice->size();
+
+    // Old payloads by fingerprint, to find unchanged ones in new archive
+    QMultiHash<size_t, PayloadBlock> oldPayloads;
+    for (const PayloadBlock &block : payloadBlocks(&oldReader, oldSize))
+        oldPayloads.insert(qHash(oldReader.readData(block.dataOffset)), block);
+
+    QDataStream stream(patch);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << patchMagic << patchVersion
+           << quint64(oldSize) << metadataDigest(&oldReader, oldSize)
+           << quint64(newSize) << fileDigest(newDevice);
+
+    // Walk new archive in file order, contiguous copies are joined
+    qint64 pos = 0;
+    qint64 copyOffset = 0;
+    qint64 copySize = 0;
+    for (const PayloadBlock &block : payloadBlocks(&newReader, newSize)) {
+        // Deduplicated entries share one block
+        if (block.offset < pos)
+            continue;
+        QByteArray data = newReader.readData(block.dataOffset);
+        qint64 oldOffset = -1;
+        for (const PayloadBlock &candidate : oldPayloads.values(qHash(data))) {
+            if (candidate.size == block.size && oldReader.readData(candidate.dataOffset) == data) {
+                oldOffset = candidate.offset;
+                break;
+            }
+        }
+        // Changed payload goes to patch with following literal
+        if (oldOffset < 0)
+            continue;
+        if (copySize > 0 && (block.offset != pos || oldOffset != copyOffset + copySize)) {
+            stream << quint8(CopyOperation) << quint64(copyOffset) << quint64(copySize);
+            copySize = 0;
+        }
+        if (block.offset > pos)
+            writeLiteral(stream, newDevice, pos, block.offset);
+        if (copySize == 0)
+            copyOffset = oldOffset;
+        copySize += block.size;
+        pos = block.offset + block.size;
+    }
+    if (copySize > 0)
+        stream << quint8(CopyOperation) << quint64(copyOffset) << quint64(copySize);
+    writeLiteral(stream, newDevice, pos, newSize);
+    stream << quint8(EndOperation);
+
+    if (stream.status() != QDataStream::Ok) {
+        error = CannotWriteFile;
+        return false;
+    }
+    return true;
+}
+
+bool Lilrcc::applyPatch(QIODevice *oldDevice, QIODevice *patch, QIODevice *out, Error &error) {
+    QDataStream stream(patch);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 magic;
+    quint32 version;
+    quint64 oldSize;
+    QByteArray oldDigest;
+    quint64 newSize;
+    QByteArray newDigest;
+    stream >> magic >> version >> oldSize >> oldDigest >> newSize >> newDigest;
+    if (stream.status() != QDataStream::Ok || magic != patchMagic || version != patchVersion) {
+        error = InvalidPatch;
+        return false;
+    }
+    ResourceReader oldReader(oldDevice);
+    if (oldReader.error() != NoError || quint64(oldDevice->size()) != oldSize
+        || metadataDigest(&oldReader, oldSize) != oldDigest) {
+        error = InvalidPatch;
+        return false;
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    quint64 written = 0;
+    auto write = [&](const QByteArray &data) {
+        hash.addData(data);
+        written += data.size();
+        return out->write(data) == data.size();
+    };
+    while (true) {
+        quint8 operation;
+        stream >> operation;
+        if (stream.status() != QDataStream::Ok) {
+            error = InvalidPatch;
+            return false;
+        }
+        if (operation == EndOperation)
+            break;
+        if (operation == CopyOperation) {
+            quint64 offset;
+            quint64 size;
+            stream >> offset >> size;
+            if (offset + size > oldSize || !oldDevice->seek(offset)) {
+                error = InvalidPatch;
+                return false;
+            }
+            while (size > 0) {
+                QByteArray data = oldDevice->read(qMin<quint64>(chunkSize, size));
+                if (data.isEmpty()) {
+                    error = InvalidPatch;
+                    return false;
+                }
+                if (!write(data)) {
+                    error = CannotWriteFile;
+                    return false;
+                }
+                size -= data.size();
+            }
+        } else if (operation == LiteralOperation) {
+            QByteArray data;
+            stream >> data;
+            if (!write(data)) {
+                error = CannotWriteFile;
+                return false;
+            }
+        } else {
+            error = InvalidPatch;
+            return false;
+        }
+    }
+    if (stream.status() != QDataStream::Ok || written != newSize || hash.result() != newDigest) {
+        error = InvalidPatch;
+        return false;
+    }
+    return true;
+}
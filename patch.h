@@ -0,0 +1,19 @@
+#ifndef PATCH_H
+#define PATCH_H
+
+#include "error.h"
+
+#include <QIODevice>
+
+namespace Lilrcc {
+
+// Patch rebuilds newDevice byte for byte. Payloads also present in old
+// archive are copied from it by offset, everything else is stored in patch
+bool makePatch(QIODevice *oldDevice, QIODevice *newDevice, QIODevice *patch, Error &error);
+// Streams result to out. Fails if old is not the archive patch was made
+// for or if result differs from archive patch was made from
+bool applyPatch(QIODevice *oldDevice, QIODevice *patch, QIODevice *out, Error &error);
+
+}
+
+#endif // PATCH_H
@@ -0,0 +1,307 @@
+#include "qrc.h"
+#include "lilrcc.h"
+#include "tree.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QXmlStreamReader>
+
+// File read and compressed by worker
+struct QrcFile {
+    QByteArray data;
+    Compression compression = NoCompression;
+    quint64 lastModified = 0;
+    QByteArray digest;
+    bool reused = false;
+    bool ok = false;
+};
+
+// Bumped when manifest stops being compatible
+static const int manifestVersion = 1;
+
+// Same overrides of modification time rcc has, for reproducible builds
+static quint64 sourceDateOverride() {
+    quint64 date = qEnvironmentVariable("QT_RCC_SOURCE_DATE_OVERRIDE").toULongLong();
+    quint64 epoch = qEnvironmentVariable("SOURCE_DATE_EPOCH").toULongLong();
+    return 1000*(epoch ? epoch : date);
+}
+
+// Applies compression attributes of file element to options
+static bool readFileOptions(const QXmlStreamAttributes &attributes, Lilrcc::CompressionOptions &options) {
+    if (attributes.hasAttribute(QStringLiteral("compression-algorithm"))) {
+        QStringView algorithm = attributes.value(QStringLiteral("compression-algorithm"));
+        options.automatic = false;
+        if (algorithm == u"none")
+            options.compression = NoCompression;
+        else if (algorithm == u"zlib")
+            options.compression = ZlibCompression;
+        else if (algorithm == u"zstd")
+            options.compression = ZstdCompression;
+        else if (algorithm == u"best")
+            options.automatic = true;
+        else
+            return false;
+    }
+    bool ok = true;
+    if (attributes.hasAttribute(QStringLiteral("compress")))
+        options.level = attributes.value(QStringLiteral("compress")).toInt(&ok);
+    if (ok && attributes.hasAttribute(QStringLiteral("threshold")))
+        options.threshold = attributes.value(QStringLiteral("threshold")).toInt(&ok);
+    return ok;
+}
+
+QString Lilrcc::QrcEntry::optionsKey() const {
+    QString codec = options.automatic ? QStringLiteral("auto") : QString::number(options.compression);
+    return QStringLiteral("%1 %2 %3").arg(codec).arg(options.level).arg(options.threshold);
+}
+
+bool Lilrcc::readManifest(const QString &fileName, QrcManifest &manifest) {
+    manifest.clear();
+    QFile file(fileName);
+    if (!file.open(QIODeviceBase::ReadOnly))
+        return false;
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root["version"].toInt() != manifestVersion)
+        return false;
+    QJsonObject files = root["files"].toObject();
+    for (auto it = files.begin(); it != files.end(); ++it) {
+        QJsonObject object = it.value().toObject();
+        QrcManifestEntry entry;
+        entry.digest = QByteArray::fromHex(object["digest"].toString().toLatin1());
+        entry.options = object["options"].toString();
+        entry.compression = Compression(object["compression"].toInt());
+        entry.storedSize = object["size"].toInteger();
+        manifest.insert(it.key(), entry);
+    }
+    return true;
+}
+
+bool Lilrcc::writeManifest(const QString &fileName, const QrcManifest &manifest) {
+    QJsonObject files;
+    for (auto it = manifest.begin(); it != manifest.end(); ++it) {
+        QJsonObject object;
+        object["digest"] = QString::fromLatin1(it.value().digest.toHex());
+        object["options"] = it.value().options;
+        object["compression"] = int(it.value().compression);
+        object["size"] = qint64(it.value().storedSize);
+        files[it.key()] = object;
+    }
+    QJsonObject root;
+    root["version"] = manifestVersion;
+    root["files"] = files;
+    QSaveFile file(fileName);
+    if (!file.open(QIODeviceBase::WriteOnly))
+        return false;
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+bool Lilrcc::parseQrc(const QString &qrcPath, const CompressionOptions &options, QList<QrcEntry> &entries, QString &failed, Error &error) {
+    QFile file(qrcPath);
+    if (!file.open(QIODeviceBase::ReadOnly)) {
+        failed = qrcPath;
+        error = CannotReadFile;
+        return false;
+    }
+    QDir baseDir = QFileInfo(qrcPath).absoluteDir();
+    QXmlStreamReader xml(&file);
+    QString prefix;
+    bool inResource = false;
+    while (!xml.atEnd()) {
+        xml.readNext();
+        if (xml.isEndElement() && xml.name() == u"qresource")
+            inResource = false;
+        if (!xml.isStartElement())
+            continue;
+        if (xml.name() == u"RCC")
+            continue;
+        if (xml.name() == u"qresource") {
+            // Archive has no place for locale of entries
+            if (!xml.attributes().value(QStringLiteral("lang")).isEmpty()) {
+                xml.raiseError(QStringLiteral("Localized resources are not supported"));
+                break;
+            }
+            // Prefix always starts and ends with slash, like in rcc
+            prefix = xml.attributes().value(QStringLiteral("prefix")).toString();
+            if (!prefix.startsWith('/'))
+                prefix.prepend('/');
+            if (!prefix.endsWith('/'))
+                prefix += '/';
+            inResource = true;
+            continue;
+        }
+        if (xml.name() != u"file" || !inResource) {
+            xml.raiseError(QStringLiteral("Unexpected element"));
+            break;
+        }
+
+        QrcEntry entry;
+        entry.options = options;
+        QXmlStreamAttributes attributes = xml.attributes();
+        if (!readFileOptions(attributes, entry.options)) {
+            xml.raiseError(QStringLiteral("Bad compression attribute"));
+            break;
+        }
+        QString fileName = xml.readElementText();
+        QString alias = attributes.hasAttribute(QStringLiteral("alias")) ? attributes.value(QStringLiteral("alias")).toString() : fileName;
+        // Files from parent directories are put under prefix itself
+        alias = QDir::cleanPath(alias);
+        while (alias.startsWith("../"))
+            alias.remove(0, 3);
+
+        QFileInfo info(QDir::isRelativePath(fileName) ? baseDir.filePath(fileName) : fileName);
+        if (info.isFile()) {
+            entry.path = prefix + alias;
+            entry.fileName = info.filePath();
+            entries << entry;
+        } else if (info.isDir()) {
+            QDir dir(info.filePath());
+            QDirIterator it(info.filePath(), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+            while (it.hasNext()) {
+                QString path = it.next();
+                entry.path = prefix + alias + "/" + dir.relativeFilePath(path);
+                entry.fileName = path;
+                entries << entry;
+            }
+        } else {
+            failed = info.filePath();
+            error = CannotReadFile;
+            return false;
+        }
+    }
+    if (xml.hasError()) {
+        failed = qrcPath;
+        error = InvalidQrc;
+        return false;
+    }
+    return true;
+}
+
+bool Lilrcc::buildQrc(const QString &qrcPath, const CompressionOptions &options, const QrcReuse &reuse, ResourceTreeDir *root,
+                      QList<ResourceTreeNode*> &insertionOrder, QrcManifest &manifest, int &reused, QString &failed, Error &error) {
+    QList<QrcEntry> entries;
+    if (!parseQrc(qrcPath, options, entries, failed, error))
+        return false;
+
+    // Previous payloads are looked up here, library is not thread safe.
+    // They are reused only if they are still what manifest describes
+    QList<ResourceTreeFile*> olds(entries.size(), nullptr);
+    QList<const QrcManifestEntry*> recorded(entries.size(), nullptr);
+    if (reuse.library)
+        reuse.library->buildPathIndex();
+    for (qsizetype i = 0; i < entries.size() && reuse.library; i++) {
+        auto it = reuse.manifest.find(entries.at(i).path);
+        if (it == reuse.manifest.end() || it.value().options != entries.at(i).optionsKey())
+            continue;
+        Lilrcc::Error lookupError = Lilrcc::NoError;
+        ResourceTreeFile *old = reuse.library->getFileNode(entries.at(i).path, lookupError);
+        if (!old || old->getCompression() != it.value().compression || old->dataSize() != 4 + it.value().storedSize)
+            continue;
+        olds[i] = old;
+        recorded[i] = &it.value();
+    }
+
+    // Files are read and compressed by workers, tree is built here in qrc order
+    QList<QrcFile> files(entries.size());
+    QrcFile *results = files.data();
+    quint64 lastModifiedOverride = sourceDateOverride();
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, options.jobs));
+    for (qsizetype i = 0; i < entries.size(); i++) {
+        const QrcEntry *entry = &entries.at(i);
+        ResourceTreeFile *old = olds.at(i);
+        const QrcManifestEntry *previous = recorded.at(i);
+        QrcFile *result = results + i;
+        pool.start([entry, old, previous, result, lastModifiedOverride]() {
+            QFile file(entry->fileName);
+            if (!file.open(QIODeviceBase::ReadOnly))
+                return;
+            QByteArray data = file.readAll();
+            if (file.error() != QFileDevice::NoError)
+                return;
+            result->digest = QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+            if (old && result->digest == previous->digest) {
+                // Reader of previous archive is safe to use from several threads
+                result->data = old->getCompressed();
+                result->compression = old->getCompression();
+                result->reused = result->data.size() == qsizetype(previous->storedSize);
+            }
+            if (!result->reused)
+                result->data = Lilrcc::compress(data, entry->options, result->compression);
+            result->lastModified = lastModifiedOverride ? lastModifiedOverride
+                                                        : QFileInfo(file).lastModified().toMSecsSinceEpoch();
+            result->ok = true;
+        });
+    }
+    pool.waitForDone();
+
+    reused = 0;
+    QHash<QString, ResourceTreeNode*> nodes;
+    for (qsizetype i = 0; i < entries.size(); i++) {
+        const QrcEntry &entry = entries.at(i);
+        QrcFile &result = files[i];
+        if (!result.ok) {
+            failed = entry.fileName;
+            error = CannotReadFile;
+            return false;
+        }
+        QStringList segments = entry.path.split('/', Qt::SkipEmptyParts);
+        if (segments.isEmpty()) {
+            failed = entry.fileName;
+            error = InvalidQrc;
+            return false;
+        }
+        ResourceTreeDir *dir = root;
+        QString path;
+        for (qsizetype j = 0; j < segments.size()-1; j++) {
+            QString name = segments.at(j);
+            path += "/" + name;
+            ResourceTreeNode *&node = nodes[path];
+            if (!node) {
+                node = new ResourceTreeDir(name, qt_hash(name));
+                dir->insertChild(node);
+                insertionOrder << node;
+            } else if (!node->isDir()) {
+                failed = entry.path;
+                error = GotFileInsteadOfDir;
+                return false;
+            }
+            dir = static_cast<ResourceTreeDir*>(node);
+        }
+        QString name = segments.last();
+        ResourceTreeNode *&node = nodes[path + "/" + name];
+        if (node && node->isDir()) {
+            failed = entry.path;
+            error = GotDirInsteadOfFile;
+            return false;
+        }
+        // Later file with the same path replaces earlier one
+        if (node)
+            insertionOrder.removeOne(node);
+        QrcManifestEntry recordedEntry;
+        recordedEntry.digest = result.digest;
+        recordedEntry.options = entry.optionsKey();
+        recordedEntry.compression = result.compression;
+        recordedEntry.storedSize = result.data.size();
+        manifest.insert(entry.path, recordedEntry);
+        if (result.reused)
+            reused++;
+
+        ResourceTreeFile *file = new QByteArrayResourceTreeFile(name, qt_hash(name), result.data, result.compression);
+        file->setLastModified(result.lastModified);
+        result.data.clear();
+        dir->insertChild(file);
+        node = file;
+        insertionOrder << file;
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+#ifndef QRC_H
+#define QRC_H
+
+#include "compression.h"
+#include "error.h"
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+class ResourceLibrary;
+class ResourceTreeDir;
+class ResourceTreeNode;
+
+namespace Lilrcc {
+
+// File listed in qrc
+struct QrcEntry {
+    // Resource path, prefix followed by alias
+    QString path;
+    QString fileName;
+    // Options of qrc file overridden by its attributes
+    CompressionOptions options;
+
+    // Same options give the same string, jobs do not count
+    QString optionsKey() const;
+};
+
+// What file of archive was made from, kept in <archive>.manifest
+struct QrcManifestEntry {
+    // SHA-256 of source file
+    QByteArray digest;
+    // Compression options file was stored with, see QrcEntry::optionsKey
+    QString options;
+    Compression compression = NoCompression;
+    quint32 storedSize = 0;
+};
+typedef QHash<QString, QrcManifestEntry> QrcManifest;
+
+// Manifest that cannot be read is left empty
+bool readManifest(const QString &fileName, QrcManifest &manifest);
+bool writeManifest(const QString &fileName, const QrcManifest &manifest);
+
+// Previous build, its payloads are reused for sources which did not change
+struct QrcReuse {
+    ResourceLibrary *library = nullptr;
+    QrcManifest manifest;
+};
+
+// Lists files of qrc in its order, directories in it are expanded. Relative
+// file names are resolved against directory of qrc. If something cannot be
+// read, failed is set to its name. Resources with lang are InvalidQrc
+bool parseQrc(const QString &qrcPath, const CompressionOptions &options, QList<QrcEntry> &entries, QString &failed, Error &error);
+// Reads and compresses files of qrc on options.jobs threads and puts them
+// into root. insertionOrder gets every created node in the order rcc would
+// create it, see ResourceWriter::setRccLayout. Files whose digest and
+// options match reuse.manifest take payload of reuse.library as it is.
+// manifest gets digests of all files, reused counts files not compressed
+bool buildQrc(const QString &qrcPath, const CompressionOptions &options, const QrcReuse &reuse, ResourceTreeDir *root,
+              QList<ResourceTreeNode*> &insertionOrder, QrcManifest &manifest, int &reused, QString &failed, Error &error);
+
+}
+
+#endif // QRC_H
@@ -1,10 +1,35 @@
 #include "resourcereader.h"
+#include "fileio.h"
+#include "stats.h"
 #include "tree.h"
 
-ResourceReader::ResourceReader(QIODevice *device) {
-    m_device = device;
+#include <QFileDevice>
+#include <QHash>
+#include <QtEndian>
 
-    if (m_device->read(4) != "qres") {
+ResourceReader::ResourceReader(QIODevice *device)
+    : m_error(Lilrcc::NoError)
+    , m_version(0)
+    , m_treeOffset(0)
+    , m_dataOffset(0)
+    , m_namesOffset(0)
+    , m_overallFlags(0)
+    , m_treeEntrySize(0)
+    , m_device(device)
+    , m_fileSize(device->size())
+    , m_map(nullptr)
+    , m_mapSize(0)
+    , m_pos(0)
+{
+    QFileDevice *file = qobject_cast<QFileDevice*>(device);
+    if (file && m_fileSize > 0) {
+        m_map = file->map(0, m_fileSize);
+        if (m_map)
+            m_mapSize = m_fileSize;
+    }
+
+    seek(0);
+    if (readBytes(4) != "qres") {
         m_error = Lilrcc::InputFileIsNotRcc;
         return;
     }
@@ -14,6 +39,7 @@ ResourceReader::ResourceReader(QIODevice *device) {
     m_dataOffset = readNumber4();
     m_namesOffset = readNumber4();
 
+    m_overallFlags = 0;
     if (m_version >= 3) {
         m_overallFlags = readNumber4();
     }
@@ -23,24 +49,155 @@ ResourceReader::ResourceReader(QIODevice *device) {
     if (m_version >= 2)
         // Since version 2 rcc also have last modification date
         m_treeEntrySize += 8;
+
+    // Read names and tree sections with one read each
+    seek(m_namesOffset);
+    m_names = readBytes(sectionEnd(m_namesOffset) - m_namesOffset);
+    seek(m_treeOffset);
+    decodeTree(readBytes(sectionEnd(m_treeOffset) - m_treeOffset));
+    decodeSizes();
 }
 
 Lilrcc::Error ResourceReader::error() {
     return m_error;
 }
 
+bool ResourceReader::isMapped() {
+    return m_map != nullptr;
+}
+
+quint32 ResourceReader::version() {
+    return m_version;
+}
+
+quint32 ResourceReader::dataOffset() {
+    return m_dataOffset;
+}
+
+quint32 ResourceReader::overallFlags() {
+    return m_overallFlags;
+}
+
+QByteArray ResourceReader::names() {
+    return m_names;
+}
+
+// Section ends where next one starts, or at the end of the file
+qint64 ResourceReader::sectionEnd(quint32 offset) {
+    qint64 end = m_map ? m_mapSize : m_fileSize;
+    for (quint32 other : {m_treeOffset, m_dataOffset, m_namesOffset}) {
+        if (other > offset && other < end)
+            end = other;
+    }
+    return qMax<qint64>(end, offset);
+}
+
+// Decodes fixed size big endian records into flat list
+void ResourceReader::decodeTree(const QByteArray &tree) {
+    const uchar *records = reinterpret_cast<const uchar*>(tree.constData());
+    qsizetype count = tree.size() / m_treeEntrySize;
+    m_entries.resize(count);
+    m_entryNames.resize(count);
+    ResourceEntry *entries = m_entries.data();
+    // rcc writes every name once, entries with the same name share it
+    QHash<quint32, QString> names;
+    for (qsizetype i = 0; i < count; i++) {
+        const uchar *record = records + i*m_treeEntrySize;
+        ResourceEntry &entry = entries[i];
+        entry.nameOffset = qFromBigEndian<quint32>(record);
+        entry.flags = qFromBigEndian<quint16>(record+4);
+        // Both layouts are decoded to avoid branching on flags
+        entry.childrenCount = qFromBigEndian<quint32>(record+6);
+        entry.firstChild = qFromBigEndian<quint32>(record+10);
+        entry.language = entry.childrenCount >> 16;
+        entry.territory = entry.childrenCount;
+        entry.dataOffset = entry.firstChild;
+        entry.dataSize = 0;
+        entry.lastModified = m_version >= 2 ? qFromBigEndian<quint64>(record+14) : 0;
+        QString &name = names[entry.nameOffset];
+        if (name.isNull())
+            name = readName(entry.nameOffset);
+        m_entryNames[i] = name;
+    }
+}
+
+// Payload lengths of all files. Unmapped file has them read as one IoBatch
+void ResourceReader::decodeSizes() {
+    QList<qsizetype> files;
+    for (qsizetype i = 0; i < m_entries.size(); i++) {
+        if (!(m_entries.at(i).flags & Flags::Directory))
+            files << i;
+    }
+    QFileDevice *file = qobject_cast<QFileDevice*>(m_device);
+    if (!m_map && file && file->handle() >= 0 && files.size() > 1) {
+        QByteArray lengths(4*files.size(), Qt::Uninitialized);
+        Lilrcc::IoBatch batch;
+        for (qsizetype i = 0; i < files.size(); i++)
+            batch.read(file->handle(), m_dataOffset + qint64(m_entries.at(files.at(i)).dataOffset), lengths.data() + 4*i, 4);
+        if (batch.submit()) {
+            Lilrcc::stats().bytesRead.fetchAndAddRelaxed(lengths.size());
+            for (qsizetype i = 0; i < files.size(); i++)
+                m_entries[files.at(i)].dataSize = 4 + qFromBigEndian<quint32>(lengths.constData() + 4*i);
+            return;
+        }
+    }
+    for (qsizetype i : std::as_const(files))
+        m_entries[i].dataSize = 4 + readDataLength(m_entries.at(i).dataOffset);
+}
+
+void ResourceReader::seek(qint64 pos) {
+    if (m_map) {
+        m_pos = pos;
+        return;
+    }
+    Lilrcc::stats().seeks.fetchAndAddRelaxed(1);
+    m_device->seek(pos);
+}
+
+// Returns view into mapping if file is mapped, so it is not copied
+QByteArray ResourceReader::readBytes(qint64 size) {
+    if (!m_map) {
+        QByteArray bytes = m_device->read(size);
+        Lilrcc::stats().bytesRead.fetchAndAddRelaxed(bytes.size());
+        return bytes;
+    }
+
+    if (m_pos >= m_mapSize)
+        return {};
+    size = qMin(size, m_mapSize - m_pos);
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(m_map + m_pos), size);
+    m_pos += size;
+    return bytes;
+}
+
 quint8 ResourceReader::readNumber() {
+    if (m_map) {
+        if (m_pos >= m_mapSize)
+            return 0;
+        return m_map[m_pos++];
+    }
     char out;
+    Lilrcc::stats().getCharCalls.fetchAndAddRelaxed(1);
     m_device->getChar(&out);
     return out;
 }
 
 quint16 ResourceReader::readNumber2() {
+    if (m_map && m_pos+2 <= m_mapSize) {
+        quint16 number = qFromBigEndian<quint16>(m_map + m_pos);
+        m_pos += 2;
+        return number;
+    }
     return (readNumber() << 8)
            + (readNumber() << 0);
 }
 
 quint32 ResourceReader::readNumber4() {
+    if (m_map && m_pos+4 <= m_mapSize) {
+        quint32 number = qFromBigEndian<quint32>(m_map + m_pos);
+        m_pos += 4;
+        return number;
+    }
     return (readNumber() << 24)
            + (readNumber() << 16)
            + (readNumber() << 8)
@@ -48,7 +205,12 @@ quint32 ResourceReader::readNumber4() {
 }
 
 quint64 ResourceReader::readNumber8() {
-    return ((quint64)readNumber() << 54)
+    if (m_map && m_pos+8 <= m_mapSize) {
+        quint64 number = qFromBigEndian<quint64>(m_map + m_pos);
+        m_pos += 8;
+        return number;
+    }
+    return ((quint64)readNumber() << 56)
            + ((quint64)readNumber() << 48)
            + ((quint64)readNumber() << 40)
            + ((quint64)readNumber() << 32)
@@ -59,63 +221,172 @@ quint64 ResourceReader::readNumber8() {
 }
 
 void ResourceReader::readTreeDirChildren(ResourceTreeDir *dirNode, int nodeNumber) {
-    m_device->seek(m_treeOffset + nodeNumber*m_treeEntrySize+6);
-    quint32 childrenCount = readNumber4();
-    quint32 firstChild = readNumber4();
-
-    for (int i = 0; i < childrenCount; i++) {
-        m_device->seek(m_treeOffset + (firstChild+i)*m_treeEntrySize);
-        quint32 nameOffset = readNumber4();
-        quint16 flags = readNumber2();
-
-        QString name = readName(nameOffset);
-        quint32 nameHash = readHash(nameOffset);
-        if (flags & Flags::Directory) {
-            ResourceTreeDir *dir = new ResourceTreeDir(name, nameHash);
-            readTreeDirChildren(dir, firstChild+i);
-            dirNode->appendChild(dir);
-            continue;
-        }
+    if (nodeNumber < 0 || nodeNumber >= m_entries.size())
+        return;
+    const ResourceEntry &dirEntry = m_entries.at(nodeNumber);
 
-        // file, not dir
-        m_device->seek(m_treeOffset + (firstChild+i)*m_treeEntrySize+10);
-        quint32 dataOffset = readNumber4();
-        m_device->seek(m_dataOffset + dataOffset);
-        quint32 dataSize = 4+readNumber4();
-        if (flags & Flags::Compressed) {
-            ResourceTreeFile *file = new ZlibResourceTreeFile(name, nameHash, this, dataOffset, dataSize);
-            dirNode->appendChild(file);
-        } else if (flags & Flags::CompressedZstd) {
-            ResourceTreeFile *file = new ZstdResourceTreeFile(name, nameHash, this, dataOffset, dataSize);
-            dirNode->appendChild(file);
+    for (quint32 i = 0; i < dirEntry.childrenCount; i++) {
+        quint32 childNumber = dirEntry.firstChild+i;
+        if (childNumber >= m_entries.size())
+            break;
+        const ResourceEntry &entry = m_entries.at(childNumber);
+
+        if (entry.flags & Flags::Directory) {
+            // Its children will be read only when needed
+            dirNode->appendChild(new ResourceTreeDir(this, childNumber));
+        } else if (entry.flags & Flags::Compressed) {
+            dirNode->appendChild(new ZlibResourceTreeFile(this, childNumber));
+        } else if (entry.flags & Flags::CompressedZstd) {
+            dirNode->appendChild(new ZstdResourceTreeFile(this, childNumber));
         } else {
-            ResourceTreeFile *file = new UncompressedResourceTreeFile(name, nameHash, this, dataOffset, dataSize);
-            dirNode->appendChild(file);
+            dirNode->appendChild(new UncompressedResourceTreeFile(this, childNumber));
         }
     }
 }
 
+quint32 ResourceReader::entryCount() {
+    return m_entries.size();
+}
+
+// Number must be valid entry number
+const ResourceEntry &ResourceReader::entry(quint32 number) {
+    return m_entries.at(number);
+}
+
+QString ResourceReader::entryName(quint32 number) {
+    return m_entryNames.at(number);
+}
+
 QString ResourceReader::readName(quint32 offset) {
-    m_device->seek(m_namesOffset + offset);
-    quint16 nameLength = readNumber2();
+    if (qint64(offset)+6 > m_names.size())
+        return {};
+    const uchar *entry = reinterpret_cast<const uchar*>(m_names.constData()) + offset;
+    qsizetype nameLength = qFromBigEndian<quint16>(entry);
+    nameLength = qMin<qsizetype>(nameLength, (m_names.size()-offset-6)/2);
+    QString name(nameLength, Qt::Uninitialized);
     // Name hash, we dont need here
-    m_device->skip(4);
-    QString name;
-    name.resize(nameLength);
-    for (int i = 0; i < nameLength; i++)
-        name[i] = readNumber2();
+    qFromBigEndian<quint16>(entry+6, nameLength, name.data());
     return name;
 }
 
 quint32 ResourceReader::readHash(quint32 offset) {
-    m_device->seek(m_namesOffset + offset + 2);
-    return readNumber4();
+    if (qint64(offset)+6 > m_names.size())
+        return 0;
+    return qFromBigEndian<quint32>(m_names.constData() + offset + 2);
 }
 
 QByteArray ResourceReader::readData(quint32 dataOffset) {
-    m_device->seek(m_dataOffset + dataOffset);
+    if (m_map) {
+        // Shared position is not used here, so no locking needed
+        qint64 pos = m_dataOffset + qint64(dataOffset);
+        if (pos+4 > m_mapSize)
+            return {};
+        qint64 dataLength = qMin<qint64>(qFromBigEndian<quint32>(m_map + pos), m_mapSize-pos-4);
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(m_map + pos + 4), dataLength);
+    }
+
+    QMutexLocker locker(&m_dataMutex);
+    seek(m_dataOffset + dataOffset);
     quint32 dataLength = readNumber4();
-    return m_device->read(dataLength);
+    return readBytes(dataLength);
+}
+
+QList<QByteArray> ResourceReader::readDataBatch(const QList<quint32> &dataOffsets) {
+    QList<QByteArray> data;
+    data.reserve(dataOffsets.size());
+    QFileDevice *file = qobject_cast<QFileDevice*>(m_device);
+    if (m_map || !file || file->handle() < 0 || dataOffsets.size() < 2 || Lilrcc::ioQueueDepth() < 2) {
+        for (quint32 dataOffset : dataOffsets)
+            data << readData(dataOffset);
+        return data;
+    }
+
+    // Positioned reads do not touch device position, so no locking needed
+    Lilrcc::IoBatch batch;
+    QList<QByteArray> lengths;
+    lengths.reserve(dataOffsets.size());
+    for (quint32 dataOffset : dataOffsets) {
+        lengths << QByteArray(4, Qt::Uninitialized);
+        batch.read(file->handle(), m_dataOffset + qint64(dataOffset), lengths.last().data(), 4);
+    }
+    bool ok = batch.submit();
+    for (qsizetype i = 0; ok && i < dataOffsets.size(); i++) {
+        qint64 pos = m_dataOffset + qint64(dataOffsets.at(i)) + 4;
+        qint64 dataLength = qMin<qint64>(qFromBigEndian<quint32>(lengths.at(i).constData()), m_fileSize - pos);
+        data << QByteArray(qMax<qint64>(dataLength, 0), Qt::Uninitialized);
+        batch.read(file->handle(), pos, data.last().data(), data.last().size());
+    }
+    ok = ok && batch.submit();
+    if (!ok) {
+        data.clear();
+        for (quint32 dataOffset : dataOffsets)
+            data << readData(dataOffset);
+        return data;
+    }
+    qint64 bytesRead = 4*dataOffsets.size();
+    for (const QByteArray &payload : std::as_const(data))
+        bytesRead += payload.size();
+    Lilrcc::stats().bytesRead.fetchAndAddRelaxed(bytesRead);
+    return data;
+}
+
+quint32 ResourceReader::readDataLength(quint32 dataOffset) {
+    if (m_map) {
+        qint64 pos = m_dataOffset + qint64(dataOffset);
+        if (pos+4 > m_mapSize)
+            return 0;
+        return qFromBigEndian<quint32>(m_map + pos);
+    }
+
+    QMutexLocker locker(&m_dataMutex);
+    seek(m_dataOffset + dataOffset);
+    return readNumber4();
+}
+
+QByteArray ResourceReader::readDataRange(quint32 dataOffset, qint64 offset, qint64 length) {
+    qint64 dataLength = readDataLength(dataOffset);
+    if (offset >= dataLength)
+        return {};
+    length = qMin(length, dataLength - offset);
+    qint64 pos = m_dataOffset + qint64(dataOffset) + 4 + offset;
+    if (m_map) {
+        if (pos + length > m_mapSize)
+            return {};
+        return QByteArray::fromRawData(reinterpret_cast<const char*>(m_map + pos), length);
+    }
+
+    QMutexLocker locker(&m_dataMutex);
+    seek(pos);
+    return readBytes(length);
+}
+
+Lilrcc::CopyResult ResourceReader::copyData(quint32 dataOffset, quint32 dataSize, QIODevice *device) {
+    QFileDevice *in = qobject_cast<QFileDevice*>(m_device);
+    QFileDevice *out = qobject_cast<QFileDevice*>(device);
+    if (!in || !out || in->handle() < 0 || out->handle() < 0)
+        return Lilrcc::NotCopied;
+    // Data written through device must reach file before copied one
+    out->flush();
+    Lilrcc::CopyResult result = Lilrcc::copyFileRange(in->handle(), m_dataOffset + dataOffset, out->handle(), dataSize);
+    if (result == Lilrcc::Copied)
+        Lilrcc::stats().bytesCopied.fetchAndAddRelaxed(dataSize);
+    return result;
+}
+
+Lilrcc::CopyResult ResourceReader::copyPayload(quint32 dataOffset, QIODevice *device) {
+    QFileDevice *in = qobject_cast<QFileDevice*>(m_device);
+    QFileDevice *out = qobject_cast<QFileDevice*>(device);
+    if (!in || !out || in->handle() < 0 || out->handle() < 0)
+        return Lilrcc::NotCopied;
+    qint64 pos = m_dataOffset + qint64(dataOffset) + 4;
+    qint64 length = readDataLength(dataOffset);
+    if (pos + length > m_fileSize)
+        return Lilrcc::NotCopied;
+    out->flush();
+    Lilrcc::CopyResult result = Lilrcc::copyFileRange(in->handle(), pos, out->handle(), length);
+    if (result == Lilrcc::Copied)
+        Lilrcc::stats().bytesCopied.fetchAndAddRelaxed(length);
+    return result;
 }
 
 void ResourceReader::printHeader(QTextStream &out) {
@@ -128,40 +399,29 @@ void ResourceReader::printHeader(QTextStream &out) {
 }
 
 void ResourceReader::printEntries(QTextStream &out) {
-    m_device->seek(m_treeOffset);
-    int pending = 1;
-    while (pending > 0) {
+    qint64 pending = 1;
+    for (qsizetype i = 0; i < m_entries.size() && pending > 0; i++) {
         pending--;
-        quint32 nameOffset = readNumber4();
-        out << "Name: " << nameOffset;
-        quint16 flags = readNumber2();
-        if (flags & Flags::Directory) {
-            quint32 children = readNumber4();
-            out << " Children: " << children;
-            pending += children;
-            readNumber4(); // useless offset
+        const ResourceEntry &entry = m_entries.at(i);
+        out << "Name: " << entry.nameOffset;
+        if (entry.flags & Flags::Directory) {
+            out << " Children: " << entry.childrenCount;
+            pending += entry.childrenCount;
         } else {
-            out << " Language: " << readNumber2();
-            out << " Territory: " << readNumber2();
-            out << " Data: " << readNumber4();
+            out << " Language: " << entry.language;
+            out << " Territory: " << entry.territory;
+            out << " Data: " << entry.dataOffset;
         }
-        if (m_version >= 2)
-            readNumber8();
         out << "\n";
     }
 }
 
 void ResourceReader::printNames(QTextStream &out) {
-    quint32 namesSize = m_treeOffset - m_namesOffset;
-    m_device->seek(m_namesOffset);
+    quint32 namesSize = m_names.size();
     quint32 offset = 0;
-    while (offset < namesSize) {
-        quint16 nameSize = readNumber2();
-        quint32 nameHash = readNumber4();
-        out << offset << ": ";
-        for (int i = 0; i < nameSize; i++)
-            out << QChar(readNumber2());
-        out << "\n";
+    while (offset+6 <= namesSize) {
+        quint16 nameSize = qFromBigEndian<quint16>(m_names.constData() + offset);
+        out << offset << ": " << readName(offset) << "\n";
         offset += 2+4+2*nameSize;
     }
 }
@@ -2,28 +2,79 @@
 #define LILRCCREADER_H
 
 #include "error.h"
+#include "fileio.h"
 
 #include <QString>
+#include <QList>
 #include <QIODevice>
+#include <QMutex>
 #include <QTextStream>
 
+// Decoded tree entry
+struct ResourceEntry {
+    quint32 nameOffset;
+    quint16 flags;
+    // Only for directories
+    quint32 childrenCount;
+    quint32 firstChild;
+    // Only for files
+    quint16 language;
+    quint16 territory;
+    quint32 dataOffset;
+    // Only for files, payload with its length as stored in data section
+    quint32 dataSize;
+    // Zero if version < 2
+    quint64 lastModified;
+};
+
 class ResourceTreeDir;
 class ResourceReader {
 public:
+    // If device is a file, it is mapped into memory and all reads are served
+    // from the mapping, so the file must stay open while reader and data
+    // returned by it are alive
     ResourceReader(QIODevice *device);
 
     Lilrcc::Error error();
+    bool isMapped();
+    quint32 version();
+    quint32 dataOffset();
+    quint32 overallFlags();
+    // Raw names section, entry name offsets point into it
+    QByteArray names();
 
     void readTreeDirChildren(ResourceTreeDir *dirNode, int nodeNumber);
+    quint32 entryCount();
+    const ResourceEntry &entry(quint32 number);
+    // Decoded name of entry, number must be valid entry number
+    QString entryName(quint32 number);
     QString readName(quint32 offset);
     quint32 readHash(quint32 offset);
+    // Safe to call from several threads
     QByteArray readData(quint32 dataOffset);
+    // Same as readData for every offset. If file is not mapped, all lengths
+    // and then all payloads are read as one IoBatch each
+    QList<QByteArray> readDataBatch(const QList<quint32> &dataOffsets);
+    quint32 readDataLength(quint32 dataOffset);
+    // Part of data, only it is read from device
+    QByteArray readDataRange(quint32 dataOffset, qint64 offset, qint64 length);
+    // Writes raw entry of dataSize bytes, including its length, to device
+    // without reading it into memory, see Lilrcc::copyFileRange
+    Lilrcc::CopyResult copyData(quint32 dataOffset, quint32 dataSize, QIODevice *device);
+    // Same for payload alone, without its length
+    Lilrcc::CopyResult copyPayload(quint32 dataOffset, QIODevice *device);
 
     void printHeader(QTextStream &out);
     void printEntries(QTextStream &out);
     void printNames(QTextStream &out);
 
 private:
+    qint64 sectionEnd(quint32 offset);
+    void decodeTree(const QByteArray &tree);
+    void decodeSizes();
+
+    void seek(qint64 pos);
+    QByteArray readBytes(qint64 size);
     quint8 readNumber();
     quint16 readNumber2();
     quint32 readNumber4();
@@ -39,7 +90,22 @@ private:
     quint32 m_overallFlags;
     quint32 m_treeEntrySize;
 
+    // Whole names section and tree decoded at once. Entries, their names
+    // and sizes are filled in constructor and only read afterwards, so
+    // nodes pointing into them can be used from several threads
+    QByteArray m_names;
+    QList<ResourceEntry> m_entries;
+    QList<QString> m_entryNames;
+
     QIODevice *m_device;
+    // Taken once, workers reading in parallel do not ask device for it
+    qint64 m_fileSize;
+    // Guards device position in readData when file is not mapped
+    QMutex m_dataMutex;
+    // Whole file mapping, nullptr if device cannot be mapped
+    const uchar *m_map;
+    qint64 m_mapSize;
+    qint64 m_pos;
 };
 
 #endif // LILRCCREADER_H
@@ -0,0 +1,109 @@
+#include "resourceserver.h"
+#include "lilrcc.h"
+
+#include <QDataStream>
+#include <QLocalServer>
+#include <QLocalSocket>
+
+ResourceServer::ResourceServer(ResourceLibrary *library, qint64 cacheSize)
+    : m_library(library)
+    , m_cache(cacheSize)
+    , m_server(new QLocalServer)
+{
+    QObject::connect(m_server, &QLocalServer::newConnection, [this]() {
+        while (m_server->hasPendingConnections()) {
+            QLocalSocket *socket = m_server->nextPendingConnection();
+            QObject::connect(socket, &QLocalSocket::readyRead, [this, socket]() {
+                readRequests(socket);
+            });
+            QObject::connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+        }
+    });
+}
+
+ResourceServer::~ResourceServer() {
+    delete m_server;
+}
+
+bool ResourceServer::listen(const QString &socketPath) {
+    // Socket may be left from server which was killed
+    QLocalServer::removeServer(socketPath);
+    return m_server->listen(socketPath);
+}
+
+QString ResourceServer::errorString() {
+    return m_server->errorString();
+}
+
+void ResourceServer::readRequests(QLocalSocket *socket) {
+    QDataStream stream(socket);
+    stream.setVersion(QDataStream::Qt_6_0);
+    while (true) {
+        // Request may come in several parts, wait for the rest then
+        stream.startTransaction();
+        quint8 command;
+        QString path;
+        stream >> command >> path;
+        if (!stream.commitTransaction())
+            return;
+
+        Lilrcc::Error error = Lilrcc::NoError;
+        QByteArray data = answer(Command(command), path, error);
+        stream << quint32(error) << data;
+    }
+}
+
+// Spellings of the same path share one cache entry, segments are split
+// the same way ResourceLibrary does it
+static QString cacheKey(QString path) {
+    if (path.startsWith(":/"))
+        path.remove(0, 2);
+    return "/" + path.split('/', Qt::SkipEmptyParts).join('/');
+}
+
+QByteArray ResourceServer::answer(Command command, const QString &path, Lilrcc::Error &error) {
+    switch (command) {
+    case Cat: {
+        QString key = cacheKey(path);
+        if (QByteArray *cached = m_cache.object(key))
+            return *cached;
+        QByteArray data = m_library->getFile(path, error);
+        if (error == Lilrcc::NoError)
+            m_cache.insert(key, new QByteArray(data), data.size());
+        return data;
+    }
+    case Ls:
+        return m_library->ls(path, error).join("\n").toUtf8();
+    case Stat:
+        return m_library->stat(path, error).toUtf8();
+    }
+    error = Lilrcc::EntryNotFound;
+    return {};
+}
+
+QByteArray ResourceServer::request(const QString &socketPath, Command command, const QString &path, Lilrcc::Error &error) {
+    QLocalSocket socket;
+    socket.connectToServer(socketPath);
+    if (!socket.waitForConnected()) {
+        error = Lilrcc::CannotConnect;
+        return {};
+    }
+
+    QDataStream stream(&socket);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << quint8(command) << path;
+    while (true) {
+        if (!socket.waitForReadyRead()) {
+            error = Lilrcc::CannotConnect;
+            return {};
+        }
+        stream.startTransaction();
+        quint32 answerError;
+        QByteArray data;
+        stream >> answerError >> data;
+        if (stream.commitTransaction()) {
+            error = Lilrcc::Error(answerError);
+            return data;
+        }
+    }
+}
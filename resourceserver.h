@@ -0,0 +1,43 @@
+#ifndef RESOURCESERVER_H
+#define RESOURCESERVER_H
+
+#include "error.h"
+
+#include <QByteArray>
+#include <QCache>
+#include <QString>
+
+class QLocalServer;
+class QLocalSocket;
+class ResourceLibrary;
+
+// Serves library over local socket. Every request is QDataStream encoded
+// quint8 command and QString path, answer is quint32 error and QByteArray
+class ResourceServer {
+public:
+    enum Command : quint8 {
+        Cat = 1,
+        Ls = 2,
+        Stat = 3
+    };
+
+    // Decompressed files are cached until cacheSize bytes are used
+    ResourceServer(ResourceLibrary *library, qint64 cacheSize);
+    ~ResourceServer();
+
+    bool listen(const QString &socketPath);
+    QString errorString();
+
+    // Sends one request to running server and waits for answer
+    static QByteArray request(const QString &socketPath, Command command, const QString &path, Lilrcc::Error &error);
+
+private:
+    void readRequests(QLocalSocket *socket);
+    QByteArray answer(Command command, const QString &path, Lilrcc::Error &error);
+
+    ResourceLibrary *m_library;
+    QCache<QString, QByteArray> m_cache;
+    QLocalServer *m_server;
+};
+
+#endif // RESOURCESERVER_H
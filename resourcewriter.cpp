@@ -1,8 +1,50 @@
 #include "resourcewriter.h"
+#include "fileio.h"
+#include "resourcereader.h"
+#include "stats.h"
 #include "tree.h"
 
+#include <QFileDevice>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtEndian>
+
+// Payloads being transcoded at once are limited by their size
+static const qint64 maxTranscodeBytes = 64*1024*1024;
+
 ResourceWriter::ResourceWriter(QIODevice *device) {
     m_device = device;
+    m_error = Lilrcc::NoError;
+    m_deduplicate = false;
+    m_bytesSaved = 0;
+    m_appendReader = nullptr;
+    m_dataStart = 0;
+    m_bytesWritten = 0;
+    m_writeCalls = 0;
+    m_rccLayout = false;
+}
+
+void ResourceWriter::setDeduplicate(bool deduplicate) {
+    m_deduplicate = deduplicate;
+}
+
+void ResourceWriter::setRccLayout(const QList<ResourceTreeNode*> &insertionOrder) {
+    m_rccLayout = true;
+    m_insertionOrder.clear();
+    for (qsizetype i = 0; i < insertionOrder.size(); i++)
+        m_insertionOrder.insert(insertionOrder.at(i), i);
+}
+
+quint64 ResourceWriter::bytesSaved() {
+    return m_bytesSaved;
+}
+
+Lilrcc::Error ResourceWriter::error() {
+    return m_error;
 }
 
 void ResourceWriter::write(ResourceTreeDir *dir, quint32 version) {
@@ -15,15 +57,234 @@ void ResourceWriter::write(ResourceTreeDir *dir, quint32 version) {
     // this will calculate offsets and flags
     enumerateEntries(dir);
 
+    quint64 start = m_bytesWritten;
     writeHeader();
+    Lilrcc::stats().headerBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    start = m_bytesWritten;
+    writeData(dir);
+    Lilrcc::stats().dataBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    if (m_error != Lilrcc::NoError)
+        return;
+    start = m_bytesWritten;
+    writeNames();
+    Lilrcc::stats().namesBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    start = m_bytesWritten;
+    writeTree(dir);
+    Lilrcc::stats().treeBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    Lilrcc::stats().writeCalls.fetchAndAddRelaxed(m_writeCalls);
+}
+
+void ResourceWriter::append(ResourceTreeDir *dir, ResourceReader *reader) {
+    m_appendReader = reader;
+    m_version = reader->version();
+    m_dataOffset = reader->dataOffset();
+    m_overallFlags = reader->overallFlags();
+    qint64 end = m_device->size();
+    m_dataStart = end - m_dataOffset;
+    m_namesOffset = end;
+    m_treeOffset = end;
+    enumerateEntries(dir);
 
+    m_device->seek(end);
+    quint64 start = m_bytesWritten;
     writeData(dir);
+    Lilrcc::stats().dataBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    if (m_error != Lilrcc::NoError)
+        return;
+    start = m_bytesWritten;
     writeNames();
+    Lilrcc::stats().namesBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    start = m_bytesWritten;
     writeTree(dir);
+    Lilrcc::stats().treeBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+
+    // Old tree and names stay as dead space, until archive is compacted
+    start = m_bytesWritten;
+    m_device->seek(8);
+    writeNumber4(m_treeOffset);
+    writeNumber4(m_dataOffset);
+    writeNumber4(m_namesOffset);
+    if (m_version >= 3)
+        writeNumber4(m_overallFlags);
+    Lilrcc::stats().headerBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    Lilrcc::stats().writeCalls.fetchAndAddRelaxed(m_writeCalls);
+}
+
+void ResourceWriter::writeBytes(const char *data, qint64 size) {
+    m_device->write(data, size);
+    m_bytesWritten += size;
+    m_writeCalls++;
+}
+
+// Payload converted on worker thread
+struct TranscodeJob {
+    QByteArray result;
+    Lilrcc::Error error = Lilrcc::NoError;
+    bool done = false;
+};
+
+static Compression entryCompression(quint16 flags) {
+    if (flags & Flags::Compressed)
+        return ZlibCompression;
+    if (flags & Flags::CompressedZstd)
+        return ZstdCompression;
+    return NoCompression;
+}
+
+bool ResourceWriter::transcode(ResourceReader *reader, const Lilrcc::CompressionOptions &options, Lilrcc::Error &error) {
+    Compression to = options.compression;
+    // Payloads in data section order, entries may share one
+    QMap<quint32, Compression> sources;
+    for (quint32 i = 0; i < reader->entryCount(); i++) {
+        const ResourceEntry &entry = reader->entry(i);
+        if (!(entry.flags & Flags::Directory))
+            sources.insert(entry.dataOffset, entryCompression(entry.flags));
+    }
+    QList<quint32> offsets = sources.keys();
+
+    // Data is spooled, header needs size of data section before it
+    QTemporaryFile spool;
+    if (!spool.open()) {
+        error = Lilrcc::CannotWriteFile;
+        return false;
+    }
+
+    QList<TranscodeJob> jobs(offsets.size());
+    TranscodeJob *results = jobs.data();
+    QList<qint64> costs(offsets.size());
+    QMutex mutex;
+    QWaitCondition finished;
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, options.jobs));
+
+    // Results are written in order, new payloads are started while bytes
+    // in flight fit the limit, but at least one is always running
+    QHash<quint32, quint32> newOffsets;
+    quint32 spoolSize = 0;
+    qint64 inFlight = 0;
+    qsizetype next = 0;
+    // Payload of next which did not fit yet, it is not read again
+    QByteArray pending;
+    bool hasPending = false;
+    for (qsizetype written = 0; written < offsets.size(); written++) {
+        while (next < offsets.size()) {
+            QByteArray data = hasPending ? pending : reader->readData(offsets.at(next));
+            pending = QByteArray();
+            hasPending = false;
+            Compression from = sources.value(offsets.at(next));
+            // Uncompressed result can be much bigger than payload
+            qint64 resultSize = to == NoCompression ? qMax<qint64>(Lilrcc::uncompressedSize(data, from), data.size()) : data.size();
+            costs[next] = data.size() + resultSize;
+            if (next > written && inFlight + costs.at(next) > maxTranscodeBytes) {
+                pending = data;
+                hasPending = true;
+                break;
+            }
+            inFlight += costs.at(next);
+            TranscodeJob *job = results + next;
+            int level = options.level;
+            pool.start([data, from, to, level, job, &mutex, &finished]() {
+                QByteArray result;
+                Lilrcc::Error error = Lilrcc::NoError;
+                Lilrcc::transcode(data, from, to, level, result, error);
+                QMutexLocker locker(&mutex);
+                job->result = result;
+                job->error = error;
+                job->done = true;
+                finished.wakeAll();
+            });
+            next++;
+        }
+
+        QMutexLocker locker(&mutex);
+        while (!results[written].done)
+            finished.wait(&mutex);
+        locker.unlock();
+
+        TranscodeJob &job = results[written];
+        if (job.error != Lilrcc::NoError) {
+            error = job.error;
+            return false;
+        }
+        newOffsets.insert(offsets.at(written), spoolSize);
+        QByteArray length(4, Qt::Uninitialized);
+        qToBigEndian<quint32>(job.result.size(), length.data());
+        if (spool.write(length) != 4 || spool.write(job.result) != job.result.size()) {
+            error = Lilrcc::CannotWriteFile;
+            return false;
+        }
+        spoolSize += 4 + job.result.size();
+        inFlight -= costs.at(written);
+        job.result = QByteArray();
+    }
+    if (!spool.flush()) {
+        error = Lilrcc::CannotWriteFile;
+        return false;
+    }
+
+    QByteArray names = reader->names();
+    m_version = reader->version();
+    m_dataOffset = 20;
+    if (m_version >= 3) m_dataOffset += 4;
+    m_namesOffset = m_dataOffset + spoolSize;
+    m_treeOffset = m_namesOffset + names.size();
+    m_overallFlags = sources.isEmpty() ? 0 : to;
+
+    quint64 start = m_bytesWritten;
+    writeHeader();
+    Lilrcc::stats().headerBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+
+    // Spooled data section goes to output without passing through memory
+    QFileDevice *out = qobject_cast<QFileDevice*>(m_device);
+    Lilrcc::CopyResult copied = Lilrcc::NotCopied;
+    if (out && out->handle() >= 0) {
+        out->flush();
+        copied = Lilrcc::copyFileRange(spool.handle(), 0, out->handle(), spoolSize);
+    }
+    if (copied == Lilrcc::CopyFailed) {
+        error = Lilrcc::CannotWriteFile;
+        return false;
+    }
+    if (copied == Lilrcc::Copied) {
+        m_bytesWritten += spoolSize;
+    } else {
+        spool.seek(0);
+        while (!spool.atEnd()) {
+            QByteArray chunk = spool.read(1024*1024);
+            writeBytes(chunk.constData(), chunk.size());
+        }
+    }
+    Lilrcc::stats().dataBytes.fetchAndAddRelaxed(spoolSize);
+
+    start = m_bytesWritten;
+    writeBytes(names.constData(), names.size());
+    Lilrcc::stats().namesBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+
+    // Tree is kept in its order, so child numbers stay valid
+    start = m_bytesWritten;
+    for (quint32 i = 0; i < reader->entryCount(); i++) {
+        const ResourceEntry &entry = reader->entry(i);
+        writeNumber4(entry.nameOffset);
+        if (entry.flags & Flags::Directory) {
+            writeNumber2(entry.flags);
+            writeNumber4(entry.childrenCount);
+            writeNumber4(entry.firstChild);
+        } else {
+            writeNumber2((entry.flags & ~(Flags::Compressed | Flags::CompressedZstd)) | to);
+            writeNumber2(entry.language);
+            writeNumber2(entry.territory);
+            writeNumber4(newOffsets.value(entry.dataOffset));
+        }
+        if (m_version >= 2)
+            writeNumber8(entry.lastModified);
+    }
+    Lilrcc::stats().treeBytes.fetchAndAddRelaxed(m_bytesWritten - start);
+    Lilrcc::stats().writeCalls.fetchAndAddRelaxed(m_writeCalls);
+    return true;
 }
 
 void ResourceWriter::writeNumber(quint8 number) {
-    m_device->write((char*)&number, 1);
+    writeBytes((char*)&number, 1);
 }
 
 void ResourceWriter::writeNumber2(quint16 number) {
@@ -50,7 +311,7 @@ void ResourceWriter::writeNumber8(quint64 number) {
 }
 
 void ResourceWriter::writeHeader() {
-    m_device->write("qres");
+    writeBytes("qres", 4);
     writeNumber4(m_version);
     // write zeroes to rewrite later
     writeNumber4(m_treeOffset); // tree offset
@@ -61,59 +322,131 @@ void ResourceWriter::writeHeader() {
 }
 
 quint32 ResourceWriter::writeData(ResourceTreeDir *dir) {
-    QList<ResourceTreeDir*> pending;
-    pending << dir;
-    int dataOffset = 0;
-    while (!pending.isEmpty()) {
-        ResourceTreeDir *dir = pending.takeFirst();
-        for (ResourceTreeNode *child : dir->children()) {
-            if (child->isDir())
-                pending << static_cast<ResourceTreeDir*>(child);
-            else {
-                ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
-                QByteArray data = file->getCompressed();
-                writeNumber4(data.size());
+    // Payloads going to a file are written as IoBatch at known positions,
+    // device is only moved to the end of them when batch is submitted
+    QFileDevice *out = qobject_cast<QFileDevice*>(m_device);
+    bool batched = out && !out->fileName().isEmpty() && out->handle() >= 0 && Lilrcc::ioQueueDepth() > 1;
+    Lilrcc::IoBatch batch;
+    // Lengths and payloads of queued writes, alive until batch is submitted
+    QList<QByteArray> queued;
+    qint64 batchStart = m_device->pos();
+    qint64 batchEnd = batchStart;
+    auto flushBatch = [&]() {
+        if (queued.isEmpty())
+            return;
+        // Data buffered by device goes before batch
+        out->flush();
+        if (!batch.submit()) {
+            m_device->seek(batchStart);
+            for (const QByteArray &data : std::as_const(queued))
                 m_device->write(data);
-                dataOffset += 4 + data.size();
-            }
         }
+        m_device->seek(batchEnd);
+        queued.clear();
+        batchStart = batchEnd;
+    };
+
+    int dataOffset = 0;
+    for (ResourceTreeNode *child : dataOrder(dir)) {
+        if (child->isDir())
+            continue;
+        ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
+        // Its data was already written for other entry or kept in place
+        if (m_written.contains(file))
+            continue;
+        // Unchanged entries are copied from source archive as is
+        if (dynamic_cast<RccResourceTreeFile*>(file))
+            flushBatch();
+        // Broken copy cannot be written again, output is lost
+        Lilrcc::CopyResult copied = file->copyCompressed(m_device);
+        if (copied == Lilrcc::CopyFailed) {
+            m_error = Lilrcc::CannotWriteFile;
+            return dataOffset;
+        }
+        if (copied == Lilrcc::Copied) {
+            m_bytesWritten += file->dataSize();
+            dataOffset += file->dataSize();
+            // Kernel moved file past copied data, position of device is stale
+            batchEnd += file->dataSize();
+            batchStart = batchEnd;
+            if (out && !out->isSequential())
+                m_device->seek(batchEnd);
+            continue;
+        }
+        QByteArray data = file->getCompressed();
+        if (!batched) {
+            writeNumber4(data.size());
+            writeBytes(data.constData(), data.size());
+        } else {
+            QByteArray length(4, Qt::Uninitialized);
+            qToBigEndian(quint32(data.size()), length.data());
+            queued << length << data;
+            batch.write(out->handle(), batchEnd, length.constData(), 4);
+            batch.write(out->handle(), batchEnd + 4, data.constData(), data.size());
+            batchEnd += 4 + data.size();
+            m_bytesWritten += 4 + data.size();
+            m_writeCalls += 2;
+            if (batch.size() >= 4*Lilrcc::ioQueueDepth())
+                flushBatch();
+        }
+        dataOffset += 4 + data.size();
     }
+    flushBatch();
     return dataOffset;
 }
 
 void ResourceWriter::enumerateEntries(ResourceTreeDir *dir) {
-    QList<ResourceTreeDir*> pending;
-    pending << dir;
     quint32 namesSize = 0;
     quint32 dataSize = 0;
-    while (!pending.isEmpty()) {
-        ResourceTreeDir *dir = pending.takeFirst();
-        for (ResourceTreeNode *child : dir->children()) {
-            if (child->isDir())
-                pending << static_cast<ResourceTreeDir*>(child);
+    for (ResourceTreeNode *child : dataOrder(dir)) {
+        // names
+        QString name = child->name();
+        if (!m_names.contains(name)) {
+            m_names.insert(name, namesSize);
+            m_writeNames.append(name);
+            namesSize += 2+4+2*name.size();
+        }
 
-            // names
-            QString name = child->name();
-            if (!m_names.contains(name)) {
-                m_names.insert(name, namesSize);
-                m_writeNames.append(name);
-                namesSize += 2+4+2*name.size();
+        // data+flags
+        if (!child->isDir()) {
+            ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
+            Compression compr = file->getCompression();
+            m_overallFlags |= compr;
+            RccResourceTreeFile *rccFile = dynamic_cast<RccResourceTreeFile*>(file);
+            if (m_appendReader && rccFile && rccFile->reader() == m_appendReader) {
+                m_files.insert(file, rccFile->dataOffset());
+                m_written.insert(file);
+                continue;
             }
-
-            // data+flags
-            if (!child->isDir()) {
-                ResourceTreeFile *file = static_cast<ResourceTreeFile*>(child);
-                m_files.insert(file, dataSize);
-                dataSize += file->dataSize();
-                Compression compr = file->getCompression();
-                m_overallFlags |= compr;
+            ResourceTreeFile *original = m_deduplicate ? findDuplicate(file) : nullptr;
+            if (original) {
+                m_files.insert(file, m_files.value(original));
+                m_written.insert(file);
+                m_bytesSaved += file->dataSize();
+                continue;
             }
+            m_files.insert(file, m_dataStart + dataSize);
+            dataSize += file->dataSize();
         }
     }
     m_namesOffset += dataSize;
     m_treeOffset += dataSize + namesSize;
 }
 
+// Returns already enumerated file with the same compressed data
+ResourceTreeFile *ResourceWriter::findDuplicate(ResourceTreeFile *file) {
+    QByteArray data = file->getCompressed();
+    Compression compr = file->getCompression();
+    size_t fingerprint = qHash(data, compr);
+    for (ResourceTreeFile *candidate : m_payloads.values(fingerprint)) {
+        // Fingerprints may collide, so compare whole data
+        if (candidate->getCompression() == compr && candidate->getCompressed() == data)
+            return candidate;
+    }
+    m_payloads.insert(fingerprint, file);
+    return nullptr;
+}
+
 void ResourceWriter::writeNames() {
     for (int i = 0; i < m_writeNames.size(); i++) {
         QString name = m_writeNames.at(i);
@@ -124,21 +457,33 @@ void ResourceWriter::writeNames() {
     }
 }
 
+// Children of every directory follow each other in tree, their
+// directories are visited in queue order or, for rcc layout, stack order
 void ResourceWriter::writeTree(ResourceTreeDir *dir) {
-    QList<ResourceTreeNode*> pending;
+    QList<ResourceTreeNode*> nodes;
+    nodes << dir;
+    QHash<ResourceTreeDir*, quint32> firstChild;
+    QList<ResourceTreeDir*> pending;
     pending << dir;
-    int nodesCount = 1;
     while (!pending.isEmpty()) {
-        ResourceTreeNode *node = pending.takeFirst();
+        ResourceTreeDir *dir = m_rccLayout ? pending.takeLast() : pending.takeFirst();
+        firstChild.insert(dir, nodes.size());
+        for (ResourceTreeNode *child : dir->children()) {
+            nodes << child;
+            if (child->isDir())
+                pending << static_cast<ResourceTreeDir*>(child);
+        }
+    }
+
+    for (ResourceTreeNode *node : nodes) {
         writeNumber4(m_names.value(node->name()));
+        quint64 lastModified = 0;
         if (node->isDir()) {
             // Dir flag
             writeNumber2(Flags::Directory);
             ResourceTreeDir *dir = static_cast<ResourceTreeDir*>(node);
             writeNumber4(dir->children().size());
-            writeNumber4(nodesCount);
-            pending << dir->children();
-            nodesCount += dir->children().size();
+            writeNumber4(firstChild.value(dir));
         } else {
             ResourceTreeFile *file = static_cast<ResourceTreeFile*>(node);
             Compression compr = file->getCompression();
@@ -146,8 +491,36 @@ void ResourceWriter::writeTree(ResourceTreeDir *dir) {
             writeNumber2(0);
             writeNumber2(1);
             writeNumber4(m_files.value(file));
+            lastModified = file->lastModified();
         }
         if (m_version >= 2)
-            writeNumber8(0);
+            writeNumber8(lastModified);
+    }
+}
+
+// Order names and data are laid out in
+QList<ResourceTreeNode*> ResourceWriter::dataOrder(ResourceTreeDir *dir) {
+    QList<ResourceTreeNode*> nodes;
+    QList<ResourceTreeDir*> pending;
+    pending << dir;
+    while (!pending.isEmpty()) {
+        ResourceTreeDir *dir = m_rccLayout ? pending.takeLast() : pending.takeFirst();
+        QList<ResourceTreeNode*> children = dir->children();
+        if (m_rccLayout) {
+            // rcc keeps children in QMultiHash, so they come in its order
+            std::stable_sort(children.begin(), children.end(), [this](ResourceTreeNode *a, ResourceTreeNode *b) {
+                return m_insertionOrder.value(a, -1) < m_insertionOrder.value(b, -1);
+            });
+            QMultiHash<QString, ResourceTreeNode*> hash;
+            for (ResourceTreeNode *child : std::as_const(children))
+                hash.insert(child->name(), child);
+            children = hash.values();
+        }
+        for (ResourceTreeNode *child : std::as_const(children)) {
+            nodes << child;
+            if (child->isDir())
+                pending << static_cast<ResourceTreeDir*>(child);
+        }
     }
+    return nodes;
 }
@@ -1,10 +1,14 @@
 #ifndef RESOURCEWRITER_H
 #define RESOURCEWRITER_H
 
+#include "compression.h"
+
 #include <QIODevice>
 #include <QHash>
+#include <QSet>
 
 class ResourceLibrary;
+class ResourceReader;
 class ResourceTreeDir;
 class ResourceTreeNode;
 class ResourceTreeFile;
@@ -13,8 +17,26 @@ public:
     ResourceWriter(QIODevice *device);
 
     void write(ResourceTreeDir *dir, quint32 version);
+    // Device must be archive reader reads. Only new data, names and tree
+    // are appended to the end and header is patched to point to them
+    void append(ResourceTreeDir *dir, ResourceReader *reader);
+    // Writes archive of reader with every payload converted to
+    // options.compression on options.jobs threads. Names section and tree
+    // order are kept, only flags and data offsets in tree change
+    bool transcode(ResourceReader *reader, const Lilrcc::CompressionOptions &options, Lilrcc::Error &error);
+    // Write identical payloads only once, all entries will point to it
+    void setDeduplicate(bool deduplicate);
+    // Lays entries out the way rcc does, names and data in QMultiHash order
+    // of every directory and directories in stack order. Nodes are put into
+    // hashes in insertionOrder, so colliding names come out like in rcc.
+    // Output matches rcc only with QHashSeed::setDeterministicGlobalSeed()
+    void setRccLayout(const QList<ResourceTreeNode*> &insertionOrder);
+    quint64 bytesSaved();
+    // Set when payload could not be written, output is broken then
+    Lilrcc::Error error();
 
 private:
+    void writeBytes(const char *data, qint64 size);
     void writeNumber(quint8 number);
     void writeNumber2(quint16 number);
     void writeNumber4(quint32 number);
@@ -25,8 +47,11 @@ private:
     void enumerateEntries(ResourceTreeDir *dir);
     void writeNames();
     void writeTree(ResourceTreeDir *dir);
+    QList<ResourceTreeNode*> dataOrder(ResourceTreeDir *dir);
+    ResourceTreeFile *findDuplicate(ResourceTreeFile *file);
 
     QIODevice *m_device;
+    Lilrcc::Error m_error;
     quint32 m_version;
     quint32 m_treeOffset;
     quint32 m_dataOffset;
@@ -35,8 +60,24 @@ private:
     // This for storing offset
     QHash<QString, quint32> m_names;
     QHash<ResourceTreeFile*, quint32> m_files;
+    // Payload fingerprints of written files and files pointing to them
+    QMultiHash<size_t, ResourceTreeFile*> m_payloads;
+    // Files whose data is already in output, written for other
+    // entry or kept in place
+    QSet<ResourceTreeFile*> m_written;
+    // Archive being appended to, its files are not written again
+    ResourceReader *m_appendReader;
+    // Data offset of first written file
+    quint32 m_dataStart;
+    bool m_deduplicate;
+    quint64 m_bytesSaved;
+    bool m_rccLayout;
+    QHash<ResourceTreeNode*, qsizetype> m_insertionOrder;
     // this for writing
     QStringList m_writeNames;
+    // Counted for stats
+    quint64 m_bytesWritten;
+    quint64 m_writeCalls;
 };
 
 #endif // RESOURCEWRITER_H
@@ -0,0 +1,86 @@
+#include "stats.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+static const char *codecNames[3] = {"none", "zlib", "zstd"};
+
+void Lilrcc::CodecStats::add(qint64 in, qint64 out, qint64 elapsed) {
+    calls.fetchAndAddRelaxed(1);
+    bytesIn.fetchAndAddRelaxed(in);
+    bytesOut.fetchAndAddRelaxed(out);
+    nsecs.fetchAndAddRelaxed(elapsed);
+}
+
+Lilrcc::Stats &Lilrcc::stats() {
+    static Stats stats;
+    return stats;
+}
+
+int Lilrcc::codecIndex(Compression compression) {
+    switch (compression) {
+    case NoCompression:
+        return 0;
+    case ZlibCompression:
+        return 1;
+    case ZstdCompression:
+        return 2;
+    }
+    return 0;
+}
+
+static QJsonObject codecJson(const Lilrcc::CodecStats &codec) {
+    QJsonObject object;
+    object["calls"] = qint64(codec.calls.loadRelaxed());
+    object["bytesIn"] = qint64(codec.bytesIn.loadRelaxed());
+    object["bytesOut"] = qint64(codec.bytesOut.loadRelaxed());
+    object["msecs"] = codec.nsecs.loadRelaxed() / 1e6;
+    return object;
+}
+
+static void printCodec(QTextStream &out, const char *direction, const char *name, const Lilrcc::CodecStats &codec) {
+    if (codec.calls.loadRelaxed() == 0)
+        return;
+    out << direction << " " << name << ": " << codec.calls.loadRelaxed() << " calls, "
+        << codec.bytesIn.loadRelaxed() << " bytes in, " << codec.bytesOut.loadRelaxed() << " bytes out, "
+        << codec.nsecs.loadRelaxed() / 1e6 << " ms\n";
+}
+
+void Lilrcc::printStats(QTextStream &out, bool json) {
+    const Stats &s = stats();
+    if (json) {
+        QJsonObject reader;
+        reader["seeks"] = qint64(s.seeks.loadRelaxed());
+        reader["bytesRead"] = qint64(s.bytesRead.loadRelaxed());
+        reader["getCharCalls"] = qint64(s.getCharCalls.loadRelaxed());
+        reader["bytesCopied"] = qint64(s.bytesCopied.loadRelaxed());
+        QJsonObject uncompress;
+        QJsonObject compress;
+        for (int i = 0; i < 3; i++) {
+            uncompress[codecNames[i]] = codecJson(s.uncompress[i]);
+            compress[codecNames[i]] = codecJson(s.compress[i]);
+        }
+        QJsonObject writer;
+        writer["headerBytes"] = qint64(s.headerBytes.loadRelaxed());
+        writer["dataBytes"] = qint64(s.dataBytes.loadRelaxed());
+        writer["namesBytes"] = qint64(s.namesBytes.loadRelaxed());
+        writer["treeBytes"] = qint64(s.treeBytes.loadRelaxed());
+        writer["writeCalls"] = qint64(s.writeCalls.loadRelaxed());
+        QJsonObject object;
+        object["reader"] = reader;
+        object["uncompress"] = uncompress;
+        object["compress"] = compress;
+        object["writer"] = writer;
+        out << QJsonDocument(object).toJson();
+        return;
+    }
+    out << "Reader: " << s.seeks.loadRelaxed() << " seeks, " << s.bytesRead.loadRelaxed() << " bytes read, "
+        << s.getCharCalls.loadRelaxed() << " getChar calls, " << s.bytesCopied.loadRelaxed() << " bytes copied\n";
+    for (int i = 0; i < 3; i++)
+        printCodec(out, "Uncompress", codecNames[i], s.uncompress[i]);
+    for (int i = 0; i < 3; i++)
+        printCodec(out, "Compress", codecNames[i], s.compress[i]);
+    out << "Writer: " << s.headerBytes.loadRelaxed() << " header, " << s.dataBytes.loadRelaxed() << " data, "
+        << s.namesBytes.loadRelaxed() << " names, " << s.treeBytes.loadRelaxed() << " tree bytes, "
+        << s.writeCalls.loadRelaxed() << " write calls\n";
+}
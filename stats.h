@@ -0,0 +1,47 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "tree.h"
+
+#include <QAtomicInteger>
+#include <QTextStream>
+
+namespace Lilrcc {
+
+// Work done by one codec in one direction
+struct CodecStats {
+    QAtomicInteger<quint64> calls;
+    QAtomicInteger<quint64> bytesIn;
+    QAtomicInteger<quint64> bytesOut;
+    QAtomicInteger<quint64> nsecs;
+
+    void add(qint64 in, qint64 out, qint64 elapsed);
+};
+
+// Process wide counters of hot paths, updated from any thread
+struct Stats {
+    // ResourceReader, only reads which go through device are counted
+    QAtomicInteger<quint64> seeks;
+    QAtomicInteger<quint64> bytesRead;
+    QAtomicInteger<quint64> getCharCalls;
+    QAtomicInteger<quint64> bytesCopied;
+
+    // Indexed by codecIndex
+    CodecStats uncompress[3];
+    CodecStats compress[3];
+
+    // ResourceWriter bytes per section, copied data is part of data
+    QAtomicInteger<quint64> headerBytes;
+    QAtomicInteger<quint64> dataBytes;
+    QAtomicInteger<quint64> namesBytes;
+    QAtomicInteger<quint64> treeBytes;
+    QAtomicInteger<quint64> writeCalls;
+};
+
+Stats &stats();
+int codecIndex(Compression compression);
+void printStats(QTextStream &out, bool json);
+
+}
+
+#endif // STATS_H
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Checks create lays archives out byte for byte like stock rcc. Reference
+# is made by rcc itself, so sources may change freely.
+# Usage: rcclayout.sh <lilrcc_cli> <rcc> <tests dir>
+set -e
+
+cli=$1
+rcc=$2
+tests=$(cd "$3" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# Both tools take modification times from here
+export SOURCE_DATE_EPOCH=1700000000
+export QT_RCC_SOURCE_DATE_OVERRIDE=1700000000
+
+for qrc in testsAndSources testsAndSourcesReversed; do
+    "$rcc" --binary --no-compress -o "$work/$qrc.rcc" "$tests/$qrc.qrc"
+    "$cli" create "$work/$qrc.lilrcc" --qrc "$tests/$qrc.qrc"
+    if ! cmp "$work/$qrc.rcc" "$work/$qrc.lilrcc"; then
+        echo "FAIL: $qrc.qrc is laid out differently than by rcc" >&2
+        exit 1
+    fi
+done
+
+echo "Layout matches rcc"
@@ -0,0 +1,191 @@
+#!/bin/sh
+# Round trips archives through lilrcc_cli and checks every step gives
+# back the files they were made from.
+# Usage: roundtrip.sh <lilrcc_cli> <tests dir>
+set -e
+
+cli=$1
+tests=$(cd "$2" && pwd)
+sources=$(dirname "$tests")
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# Archive file at path must be the same as file on disk
+check_cat() {
+    "$cli" "$1" cat "$2" > "$work/cat.out" || fail "cat $2 from $1"
+    cmp -s "$work/cat.out" "$3" || fail "$2 in $1 differs from $3"
+}
+
+# Empty qrc gives exactly what stock rcc made from it
+"$cli" create "$work/empty.rcc" --qrc "$tests/empty.qrc" || fail "create empty"
+cmp -s "$work/empty.rcc" "$tests/empty.rcc" || fail "empty archive differs from rcc output"
+
+# Files which are not archives are refused
+! "$cli" "$sources/main.cpp" header 2> /dev/null || fail "header of non rcc file succeeded"
+! "$cli" "$sources/main.cpp" tree 2> /dev/null || fail "tree of non rcc file succeeded"
+
+# create, uncompressed and compressed
+"$cli" create "$work/plain.rcc" --qrc "$tests/testsAndSources.qrc" || fail "create plain"
+[ -f "$work/plain.rcc.manifest" ] || fail "create wrote no manifest"
+"$cli" create "$work/zstd.rcc" --qrc "$tests/testsAndSources.qrc" --compress zstd || fail "create zstd"
+for archive in plain zstd; do
+    check_cat "$work/$archive.rcc" /sources/main.cpp "$sources/main.cpp"
+    check_cat "$work/$archive.rcc" :/sources/CMakeLists.txt "$sources/CMakeLists.txt"
+    check_cat "$work/$archive.rcc" /tests/empty.qrc "$tests/empty.qrc"
+done
+
+# cat of many files and range
+"$cli" "$work/zstd.rcc" cat /sources/lilrcc.h /sources/lilrcc.cpp > "$work/cat.out" || fail "cat of two files"
+cat "$sources/lilrcc.h" "$sources/lilrcc.cpp" | cmp -s - "$work/cat.out" || fail "cat of two files differs"
+for archive in plain zstd; do
+    "$cli" "$work/$archive.rcc" range /sources/main.cpp 100 250 > "$work/range.out" || fail "range from $archive"
+    dd if="$sources/main.cpp" bs=1 skip=100 count=250 2>/dev/null | cmp -s - "$work/range.out" || fail "range from $archive differs"
+done
+
+# --stats counts work of run, failed runs print them too
+"$cli" "$work/zstd.rcc" cat /sources/main.cpp --stats > /dev/null 2> "$work/stats.out" || fail "cat --stats"
+grep -q "Uncompress zstd: " "$work/stats.out" || fail "--stats missed decompression"
+"$cli" "$work/zstd.rcc" cat /sources/main.cpp --stats=json > /dev/null 2> "$work/stats.out" || fail "cat --stats=json"
+grep -q '"uncompress"' "$work/stats.out" || fail "--stats=json printed no JSON"
+! "$cli" "$work/zstd.rcc" cat --stats=json > /dev/null 2> "$work/stats.out" || fail "cat without path succeeded"
+grep -q '"writer"' "$work/stats.out" || fail "--stats=json not printed on failure"
+
+# extract
+"$cli" "$work/zstd.rcc" extract "$work/extracted" -j 4 || fail "extract"
+cmp -s "$work/extracted/sources/lilrcc.cpp" "$sources/lilrcc.cpp" || fail "extracted lilrcc.cpp differs"
+cmp -s "$work/extracted/tests/testsAndSources.qrc" "$tests/testsAndSources.qrc" || fail "extracted qrc differs"
+
+# serve and client, compressed files come back decompressed
+"$cli" "$work/zstd.rcc" serve --socket "$work/socket" &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$work"' EXIT
+tries=0
+while [ ! -S "$work/socket" ]; do
+    tries=$((tries + 1))
+    [ $tries -le 50 ] || fail "server did not start"
+    sleep 0.1
+done
+"$cli" client --socket "$work/socket" cat /sources/lilrcc.cpp > "$work/client.out" || fail "client cat"
+cmp -s "$work/client.out" "$sources/lilrcc.cpp" || fail "client cat differs"
+"$cli" client --socket "$work/socket" ls /tests > "$work/client.out" || fail "client ls"
+grep -q "empty.qrc" "$work/client.out" || fail "client ls missed file"
+! "$cli" client --socket "$work/socket" cat /missing 2> /dev/null || fail "client cat of missing file succeeded"
+kill $server
+wait $server 2> /dev/null || true
+
+# add in place, then compact
+cp "$work/plain.rcc" "$work/edited.rcc"
+"$cli" "$work/edited.rcc" add "$sources/README.md" /tests --in-place || fail "add in place"
+check_cat "$work/edited.rcc" /tests/README.md "$sources/README.md"
+"$cli" "$work/edited.rcc" compact || fail "compact"
+check_cat "$work/edited.rcc" /tests/README.md "$sources/README.md"
+check_cat "$work/edited.rcc" /sources/main.cpp "$sources/main.cpp"
+[ "$(wc -c < "$work/edited.rcc")" -gt "$(wc -c < "$work/plain.rcc")" ] || fail "compacted archive lost data"
+
+# add compresses only the file it adds, appended part stays small
+cp "$work/plain.rcc" "$work/added.rcc"
+"$cli" "$work/added.rcc" add "$sources/README.md" /tests --compress zstd --in-place || fail "add --compress in place"
+"$cli" "$work/added.rcc" tree > "$work/tree.out" || fail "tree"
+grep -q "README.md -zstd" "$work/tree.out" || fail "added file was not compressed"
+! grep -q "main.cpp -zstd" "$work/tree.out" || fail "add compressed files of archive"
+check_cat "$work/added.rcc" /tests/README.md "$sources/README.md"
+
+# batch runs script on one library, only files it adds are compressed
+cat > "$work/script.txt" <<EOF
+add "$sources/README.md" /tests
+mv /sources/lilrcc.h /tests
+rm /sources/CMakeLists.txt
+cat /tests/README.md "$work/batch.out"
+EOF
+"$cli" "$work/plain.rcc" batch "$work/script.txt" --compress zstd > "$work/batched.rcc" || fail "batch"
+cmp -s "$work/batch.out" "$sources/README.md" || fail "cat in batch differs"
+"$cli" "$work/batched.rcc" tree > "$work/tree.out" || fail "tree"
+grep -q "README.md -zstd" "$work/tree.out" || fail "file added by batch was not compressed"
+! grep -q "main.cpp -zstd" "$work/tree.out" || fail "batch compressed files of archive"
+! grep -q "CMakeLists.txt" "$work/tree.out" || fail "batch did not remove file"
+check_cat "$work/batched.rcc" /tests/lilrcc.h "$sources/lilrcc.h"
+check_cat "$work/batched.rcc" /tests/README.md "$sources/README.md"
+
+# auto keeps smallest of codecs and stored payload, small files stay raw
+"$cli" create "$work/zstd19.rcc" --qrc "$tests/testsAndSources.qrc" --compress zstd --level 19 || fail "create zstd 19"
+"$cli" "$work/zstd19.rcc" repack --compress auto --threshold 0 > "$work/auto.rcc" || fail "repack auto"
+[ "$(wc -c < "$work/auto.rcc")" -le "$(wc -c < "$work/zstd19.rcc")" ] || fail "repack auto made archive bigger"
+check_cat "$work/auto.rcc" /sources/lilrcc.cpp "$sources/lilrcc.cpp"
+"$cli" create "$work/autocreated.rcc" --qrc "$tests/testsAndSources.qrc" --compress auto || fail "create auto"
+"$cli" "$work/autocreated.rcc" tree > "$work/tree.out" || fail "tree"
+grep -q "lilrcc.cpp -z" "$work/tree.out" || fail "auto did not compress source"
+! grep -q "empty.qrc -z" "$work/tree.out" || fail "auto compressed file below threshold"
+check_cat "$work/autocreated.rcc" /tests/empty.qrc "$tests/empty.qrc"
+
+# transcode between every codec keeps files
+"$cli" "$work/zstd.rcc" transcode --to zlib > "$work/zlib.rcc" || fail "transcode to zlib"
+"$cli" "$work/zlib.rcc" transcode --to zstd > "$work/transcoded.rcc" || fail "transcode to zstd"
+"$cli" "$work/transcoded.rcc" transcode --to none > "$work/raw.rcc" || fail "transcode to none"
+for archive in zlib transcoded raw; do
+    check_cat "$work/$archive.rcc" /sources/main.cpp "$sources/main.cpp"
+    check_cat "$work/$archive.rcc" /tests/empty.qrc "$tests/empty.qrc"
+done
+"$cli" "$work/zlib.rcc" tree > "$work/tree.out" || fail "tree"
+grep -q "main.cpp -zlib" "$work/tree.out" || fail "transcode did not convert to zlib"
+
+# Wrong size in qCompress header is not pledged to zstd
+cat > "$work/one.qrc" <<EOF
+<RCC><qresource prefix="/"><file alias="main.cpp">$sources/main.cpp</file></qresource></RCC>
+EOF
+"$cli" create "$work/one.rcc" --qrc "$work/one.qrc" --compress zlib || fail "create one file"
+set -- $(od -An -tu1 -j12 -N4 "$work/one.rcc")
+printf '\000\000\000\001' | dd of="$work/one.rcc" bs=1 seek=$(( ($1 << 24) + ($2 << 16) + ($3 << 8) + $4 + 4 )) conv=notrunc 2>/dev/null
+check_cat "$work/one.rcc" /main.cpp "$sources/main.cpp"
+"$cli" "$work/one.rcc" transcode --to zstd > "$work/onezstd.rcc" || fail "transcode with wrong size header"
+check_cat "$work/onezstd.rcc" /main.cpp "$sources/main.cpp"
+
+# diff
+"$cli" "$work/plain.rcc" diff "$work/zstd.rcc" > "$work/diff.out" || fail "same files in other codec differ"
+set +e
+"$cli" "$work/plain.rcc" diff "$work/edited.rcc" > "$work/diff.out"
+status=$?
+set -e
+[ $status -eq 1 ] || fail "diff of different archives exited with $status"
+grep -q "added: /tests/README.md" "$work/diff.out" || fail "diff missed added file"
+
+# merge, later archives win
+"$cli" "$work/merged.rcc" merge "$work/zstd.rcc" "$work/edited.rcc" || fail "merge"
+check_cat "$work/merged.rcc" /tests/README.md "$sources/README.md"
+check_cat "$work/merged.rcc" /sources/lilrcc.h "$sources/lilrcc.h"
+
+# --dedup writes identical payloads once, all entries still read back
+cat > "$work/dup.qrc" <<EOF
+<RCC><qresource prefix="/"><file alias="a.cpp">$sources/lilrcc.cpp</file><file alias="b.cpp">$sources/lilrcc.cpp</file></qresource></RCC>
+EOF
+"$cli" create "$work/dup.rcc" --qrc "$work/dup.qrc" || fail "create duplicates"
+"$cli" "$work/dup.rcc" repack --dedup > "$work/deduped.rcc" 2> "$work/dedup.out" || fail "repack --dedup"
+grep -q "Deduplication saved" "$work/dedup.out" || fail "repack --dedup reported nothing"
+[ "$(wc -c < "$work/deduped.rcc")" -lt "$(wc -c < "$work/dup.rcc")" ] || fail "repack --dedup kept both payloads"
+check_cat "$work/deduped.rcc" /a.cpp "$sources/lilrcc.cpp"
+check_cat "$work/deduped.rcc" /b.cpp "$sources/lilrcc.cpp"
+"$cli" "$work/dedupmerged.rcc" merge "$work/plain.rcc" "$work/dup.rcc" --dedup || fail "merge --dedup"
+"$cli" "$work/plainmerged.rcc" merge "$work/plain.rcc" "$work/dup.rcc" || fail "merge"
+[ "$(wc -c < "$work/dedupmerged.rcc")" -lt "$(wc -c < "$work/plainmerged.rcc")" ] || fail "merge --dedup kept duplicates"
+check_cat "$work/dedupmerged.rcc" /b.cpp "$sources/lilrcc.cpp"
+check_cat "$work/dedupmerged.rcc" /sources/lilrcc.cpp "$sources/lilrcc.cpp"
+
+# mkpatch and applypatch
+"$cli" "$work/plain.rcc" mkpatch "$work/edited.rcc" "$work/edit.patch" || fail "mkpatch"
+"$cli" "$work/plain.rcc" applypatch "$work/edit.patch" "$work/patched.rcc" || fail "applypatch"
+cmp -s "$work/patched.rcc" "$work/edited.rcc" || fail "patched archive differs"
+
+# repack and create reusing payloads give the same archives
+"$cli" "$work/plain.rcc" repack --compress zstd > "$work/repacked.rcc" || fail "repack"
+"$cli" "$work/plain.rcc" repack --compress zstd --reuse "$work/repacked.rcc" > "$work/reused.rcc" || fail "repack --reuse"
+cmp -s "$work/reused.rcc" "$work/repacked.rcc" || fail "repack --reuse differs from repack"
+check_cat "$work/reused.rcc" /sources/main.cpp "$sources/main.cpp"
+"$cli" create "$work/rebuilt.rcc" --qrc "$tests/testsAndSources.qrc" --compress zstd --reuse "$work/zstd.rcc" 2> "$work/reuse.out" || fail "create --reuse"
+grep -q "Reused 6 of 6 files" "$work/reuse.out" || fail "create --reuse compressed files again"
+cmp -s "$work/rebuilt.rcc" "$work/zstd.rcc" || fail "create --reuse differs from create"
+
+echo "All round trips passed"
@@ -1,35 +1,25 @@
 #include "tree.h"
+#include "compression.h"
 #include "resourcereader.h"
+#include "stats.h"
 
-#include <zstd.h>
+#include <algorithm>
 
-// uses binary search for fast finding child node with specified hash
-int binSearchNode(QList<ResourceTreeNode*> children, quint32 searchHash, bool &replace) {
+// uses binary search for fast finding position of node, children are sorted
+// by name hash, and equal hashes are checked by name
+static int binSearchNode(const QList<ResourceTreeNode*> &children, ResourceTreeNode *node, bool &replace) {
     replace = false;
-    if (children.isEmpty())
-        return 0;
-
-    int childrenCount = children.size();
-    int firstChild = 0;
-
-    ResourceTreeNode *node = children.at(firstChild+childrenCount/2);
-    while (searchHash != node->nameHash()) {
-        if (searchHash < node->nameHash()) {
-            if (childrenCount == 1)
-                return firstChild+childrenCount/2;
-
-            childrenCount /= 2;
-        } else {
-            if (childrenCount == 1)
-                return firstChild+childrenCount/2+1;
-
-            firstChild += childrenCount/2;
-            childrenCount -= childrenCount/2;
+    quint32 searchHash = node->nameHash();
+    auto it = std::lower_bound(children.begin(), children.end(), searchHash,
+                               [](ResourceTreeNode *child, quint32 hash) { return child->nameHash() < hash; });
+    int pos = it - children.begin();
+    for (; it != children.end() && (*it)->nameHash() == searchHash; ++it) {
+        if ((*it)->name() == node->name()) {
+            replace = true;
+            return it - children.begin();
         }
-        node = children.at(firstChild+childrenCount/2);
     }
-    replace = true;
-    return firstChild+childrenCount/2;
+    return pos;
 }
 
 ResourceTreeNode::ResourceTreeNode(QString name, quint32 nameHash)
@@ -48,7 +38,19 @@ quint32 ResourceTreeNode::nameHash() {
 
 // Dir
 ResourceTreeDir::ResourceTreeDir(QString name, quint32 nameHash)
-    : ResourceTreeNode(name, nameHash) {}
+    : ResourceTreeNode(name, nameHash)
+    , m_reader(nullptr)
+    , m_nodeNumber(0) {}
+
+ResourceTreeDir::ResourceTreeDir(QString name, quint32 nameHash, ResourceReader *reader, quint32 nodeNumber)
+    : ResourceTreeNode(name, nameHash)
+    , m_reader(reader)
+    , m_nodeNumber(nodeNumber) {}
+
+ResourceTreeDir::ResourceTreeDir(ResourceReader *reader, quint32 nodeNumber)
+    : ResourceTreeNode(reader->entryName(nodeNumber), reader->readHash(reader->entry(nodeNumber).nameOffset))
+    , m_reader(reader)
+    , m_nodeNumber(nodeNumber) {}
 
 ResourceTreeDir::~ResourceTreeDir() {
     qDeleteAll(m_children);
@@ -59,13 +61,15 @@ bool ResourceTreeDir::isDir() {
 }
 
 bool ResourceTreeDir::appendChild(ResourceTreeNode *node) {
+    loadChildren();
     m_children.append(node);
     return true;
 }
 
 bool ResourceTreeDir::insertChild(ResourceTreeNode *node) {
+    loadChildren();
     bool replace = false;
-    int pos = binSearchNode(m_children, node->nameHash(), replace);
+    int pos = binSearchNode(m_children, node, replace);
     if (replace) {
         delete m_children[pos];
         m_children[pos] = node;
@@ -76,104 +80,226 @@ bool ResourceTreeDir::insertChild(ResourceTreeNode *node) {
 }
 
 bool ResourceTreeDir::removeChild(ResourceTreeNode *node) {
+    loadChildren();
     return m_children.removeOne(node);
 }
 
-QList<ResourceTreeNode *> ResourceTreeDir::children() {
+const QList<ResourceTreeNode *> &ResourceTreeDir::children() {
+    loadChildren();
     return m_children;
 }
 
+QList<ResourceTreeNode*> ResourceTreeDir::takeChildren() {
+    loadChildren();
+    QList<ResourceTreeNode*> children;
+    children.swap(m_children);
+    return children;
+}
+
+void ResourceTreeDir::setChildren(const QList<ResourceTreeNode*> &children) {
+    loadChildren();
+    qDeleteAll(m_children);
+    m_children = children;
+}
+
+bool ResourceTreeDir::childrenLoaded() {
+    return !m_reader;
+}
+
+void ResourceTreeDir::loadChildren() {
+    if (!m_reader)
+        return;
+    // Reset before reading, reader appends children to this dir
+    ResourceReader *reader = m_reader;
+    m_reader = nullptr;
+    reader->readTreeDirChildren(this, m_nodeNumber);
+}
+
 // File
 ResourceTreeFile::ResourceTreeFile(QString name, quint32 nameHash, quint32 dataSize)
     : ResourceTreeNode(name, nameHash)
-    , m_dataSize(dataSize) {}
+    , m_dataSize(dataSize)
+    , m_lastModified(0) {}
 
 bool ResourceTreeFile::isDir() {
     return false;
 }
 
+bool ResourceTreeFile::readInto(QByteArray &buffer, Lilrcc::Error &error) {
+    buffer = read(error);
+    return error == Lilrcc::NoError;
+}
+
+// Big uncompressed files are read in pieces of this size
+static const qint64 readChunkSize = 1024*1024;
+
+bool ResourceTreeFile::readChunks(const Lilrcc::ChunkSink &sink, Lilrcc::Error &error) {
+    if (getCompression() == NoCompression && dataSize() > 4 + readChunkSize) {
+        qint64 size = dataSize() - 4;
+        for (qint64 offset = 0; offset < size; offset += readChunkSize) {
+            QByteArray chunk = readRange(offset, readChunkSize, error);
+            if (error != Lilrcc::NoError)
+                return false;
+            // Archive is cut short
+            if (chunk.isEmpty()) {
+                error = Lilrcc::CannotReadFile;
+                return false;
+            }
+            if (!sink(chunk.constData(), chunk.size()))
+                return false;
+        }
+        return true;
+    }
+    return Lilrcc::uncompressChunks(getCompressed(), getCompression(), sink, error);
+}
+
+QByteArray ResourceTreeFile::readRange(qint64 offset, qint64 length, Lilrcc::Error &error) {
+    if (offset < 0 || length <= 0)
+        return {};
+    if (getCompression() == NoCompression)
+        return getCompressed().mid(offset, length);
+    QByteArray range;
+    qint64 pos = 0;
+    qint64 end = offset + length;
+    readChunks([&range, &pos, offset, end](const char *chunk, qsizetype size) {
+        qint64 from = qMax(offset, pos);
+        qint64 to = qMin(end, pos + size);
+        if (from < to)
+            range.append(chunk + (from - pos), to - from);
+        pos += size;
+        // Rest of file is not needed
+        return pos < end;
+    }, error);
+    return range;
+}
+
+Lilrcc::CopyResult ResourceTreeFile::copyCompressed(QIODevice *device) {
+    return Lilrcc::NotCopied;
+}
+
+Lilrcc::CopyResult ResourceTreeFile::copyUncompressed(QIODevice *device) {
+    return Lilrcc::NotCopied;
+}
+
 quint32 ResourceTreeFile::dataSize() {
     return m_dataSize;
 }
 
-UncompressedResourceTreeFile::UncompressedResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize)
-    : ResourceTreeFile(name, nameHash, dataSize)
+quint64 ResourceTreeFile::lastModified() {
+    return m_lastModified;
+}
+
+void ResourceTreeFile::setLastModified(quint64 lastModified) {
+    m_lastModified = lastModified;
+}
+
+// Name is shared with decoded names of reader, size is taken from entry
+RccResourceTreeFile::RccResourceTreeFile(ResourceReader *reader, quint32 entryNumber)
+    : ResourceTreeFile(reader->entryName(entryNumber), reader->readHash(reader->entry(entryNumber).nameOffset), 0)
     , m_reader(reader)
-    , m_dataOffset(dataOffset) {}
+    , m_entryNumber(entryNumber) {}
+
+QByteArray RccResourceTreeFile::getCompressed() {
+    return m_reader->readData(dataOffset());
+}
+
+Lilrcc::CopyResult RccResourceTreeFile::copyCompressed(QIODevice *device) {
+    return m_reader->copyData(dataOffset(), dataSize(), device);
+}
+
+quint32 RccResourceTreeFile::dataSize() {
+    return m_reader->entry(m_entryNumber).dataSize;
+}
+
+// Kept from archive unless it was set
+quint64 RccResourceTreeFile::lastModified() {
+    if (m_lastModified == 0)
+        return m_reader->entry(m_entryNumber).lastModified;
+    return m_lastModified;
+}
+
+ResourceReader *RccResourceTreeFile::reader() {
+    return m_reader;
+}
+
+quint32 RccResourceTreeFile::dataOffset() {
+    return m_reader->entry(m_entryNumber).dataOffset;
+}
+
+UncompressedResourceTreeFile::UncompressedResourceTreeFile(ResourceReader *reader, quint32 entryNumber)
+    : RccResourceTreeFile(reader, entryNumber) {}
 
 QByteArray UncompressedResourceTreeFile::read(Lilrcc::Error &error) {
-    return m_reader->readData(m_dataOffset);
+    QByteArray data = getCompressed();
+    Lilrcc::stats().uncompress[0].add(data.size(), data.size(), 0);
+    return data;
 }
 
-Compression UncompressedResourceTreeFile::getCompression() {
-    return NoCompression;
+QByteArray UncompressedResourceTreeFile::readRange(qint64 offset, qint64 length, Lilrcc::Error &error) {
+    if (offset < 0 || length <= 0)
+        return {};
+    return m_reader->readDataRange(dataOffset(), offset, length);
 }
 
-QByteArray UncompressedResourceTreeFile::getCompressed() {
-    return m_reader->readData(m_dataOffset);
+Lilrcc::CopyResult UncompressedResourceTreeFile::copyUncompressed(QIODevice *device) {
+    return m_reader->copyPayload(dataOffset(), device);
 }
 
-ZlibResourceTreeFile::ZlibResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize)
-    : ResourceTreeFile(name, nameHash, dataSize)
-    , m_reader(reader)
-    , m_dataOffset(dataOffset) {}
+Compression UncompressedResourceTreeFile::getCompression() {
+    return NoCompression;
+}
+
+ZlibResourceTreeFile::ZlibResourceTreeFile(ResourceReader *reader, quint32 entryNumber)
+    : RccResourceTreeFile(reader, entryNumber) {}
 
 QByteArray ZlibResourceTreeFile::read(Lilrcc::Error &error) {
-    QByteArray rawData = m_reader->readData(m_dataOffset);
-    return qUncompress(rawData);
+    QByteArray data;
+    readInto(data, error);
+    return data;
 }
 
-Compression ZlibResourceTreeFile::getCompression() {
-    return ZlibCompression;
+bool ZlibResourceTreeFile::readInto(QByteArray &buffer, Lilrcc::Error &error) {
+    return Lilrcc::uncompress(getCompressed(), ZlibCompression, buffer, error);
 }
 
-QByteArray ZlibResourceTreeFile::getCompressed() {
-    return m_reader->readData(m_dataOffset);
+Compression ZlibResourceTreeFile::getCompression() {
+    return ZlibCompression;
 }
 
-ZstdResourceTreeFile::ZstdResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize)
-    : ResourceTreeFile(name, nameHash, dataSize)
-    , m_reader(reader)
-    , m_dataOffset(dataOffset) {}
+ZstdResourceTreeFile::ZstdResourceTreeFile(ResourceReader *reader, quint32 entryNumber)
+    : RccResourceTreeFile(reader, entryNumber) {}
 
 QByteArray ZstdResourceTreeFile::read(Lilrcc::Error &error) {
-    QByteArray rawData = m_reader->readData(m_dataOffset);
-    size_t uncompressedSize = ZSTD_getFrameContentSize(rawData.data(), rawData.size());
-    if (ZSTD_isError(uncompressedSize)) {
-        error = Lilrcc::CannotUncompress;
-        return {};
-    }
-    QByteArray unpackedData;
-    unpackedData.resize(uncompressedSize);
-    size_t size = ZSTD_decompress(unpackedData.data(), uncompressedSize, rawData.data(), rawData.size());
-    if (ZSTD_isError(size)) {
-        error = Lilrcc::CannotUncompress;
-        return {};
-    }
-    return unpackedData;
+    QByteArray data;
+    readInto(data, error);
+    return data;
 }
 
-Compression ZstdResourceTreeFile::getCompression() {
-    return ZstdCompression;
+bool ZstdResourceTreeFile::readInto(QByteArray &buffer, Lilrcc::Error &error) {
+    return Lilrcc::uncompress(getCompressed(), ZstdCompression, buffer, error);
 }
 
-QByteArray ZstdResourceTreeFile::getCompressed() {
-    return m_reader->readData(m_dataOffset);
+Compression ZstdResourceTreeFile::getCompression() {
+    return ZstdCompression;
 }
 
-QByteArrayResourceTreeFile::QByteArrayResourceTreeFile(QString name, quint32 nameHash, QByteArray data)
+QByteArrayResourceTreeFile::QByteArrayResourceTreeFile(QString name, quint32 nameHash, QByteArray data, Compression compression)
     : ResourceTreeFile(name, nameHash, 4+data.size())
-    , m_data(data) {}
+    , m_data(data)
+    , m_compression(compression) {}
 
 QByteArray QByteArrayResourceTreeFile::read(Lilrcc::Error &error) {
-    return m_data;
+    return Lilrcc::uncompress(m_data, m_compression, error);
+}
+
+bool QByteArrayResourceTreeFile::readInto(QByteArray &buffer, Lilrcc::Error &error) {
+    return Lilrcc::uncompress(m_data, m_compression, buffer, error);
 }
 
 Compression QByteArrayResourceTreeFile::getCompression() {
-    return NoCompression;
+    return m_compression;
 }
 
 QByteArray QByteArrayResourceTreeFile::getCompressed() {
     return m_data;
 }
-
@@ -2,9 +2,13 @@
 #define TREE_H
 
 #include "error.h"
+#include "fileio.h"
 
 #include <QString>
 #include <QList>
+#include <QIODevice>
+
+#include <functional>
 
 enum Flags {
     // must match qresource.cpp and rcc.h
@@ -14,6 +18,8 @@ enum Flags {
     CompressedZstd = 0x04
 };
 
+class ResourceReader;
+
 // Abstract node
 class ResourceTreeNode {
 public:
@@ -32,15 +38,29 @@ protected:
 class ResourceTreeDir : public ResourceTreeNode {
 public:
     ResourceTreeDir(QString name, quint32 nameHash);
+    // Directory from rcc, children are read first time they are accessed
+    ResourceTreeDir(QString name, quint32 nameHash, ResourceReader *reader, quint32 nodeNumber);
+    ResourceTreeDir(ResourceReader *reader, quint32 nodeNumber);
     ~ResourceTreeDir();
 
     bool isDir() override;
     bool appendChild(ResourceTreeNode *node);
     bool insertChild(ResourceTreeNode *node);
     bool removeChild(ResourceTreeNode *node);
-    QList<ResourceTreeNode*> children();
+    const QList<ResourceTreeNode*> &children();
+    // Gives children away without deleting them, dir is left empty
+    QList<ResourceTreeNode*> takeChildren();
+    // Replaces children, they must be sorted by name hash
+    void setChildren(const QList<ResourceTreeNode*> &children);
+    // False while children are still only in archive
+    bool childrenLoaded();
 private:
+    void loadChildren();
+
     QList<ResourceTreeNode*> m_children;
+    // Set until children are loaded
+    ResourceReader *m_reader;
+    quint32 m_nodeNumber;
 };
 
 // Abstract file
@@ -50,66 +70,96 @@ enum Compression {
     ZstdCompression = Flags::CompressedZstd
 };
 
+namespace Lilrcc {
+// Receives decompressed data piece by piece, returns false to stop
+typedef std::function<bool(const char *chunk, qsizetype size)> ChunkSink;
+}
+
 class ResourceTreeFile : public ResourceTreeNode {
 public:
     ResourceTreeFile(QString name, quint32 nameHash, quint32 dataSize);
     bool isDir() override;
     virtual QByteArray read(Lilrcc::Error &error)=0;
+    // Same as read, but reuses memory of buffer
+    virtual bool readInto(QByteArray &buffer, Lilrcc::Error &error);
+    // Passes decompressed data to sink in fixed size chunks, so whole file
+    // is never in memory. Returns false if sink stopped it too
+    bool readChunks(const Lilrcc::ChunkSink &sink, Lilrcc::Error &error);
+    // Part of decompressed data, compressed files are decoded up to its end
+    virtual QByteArray readRange(qint64 offset, qint64 length, Lilrcc::Error &error);
     virtual Compression getCompression()=0;
     virtual QByteArray getCompressed()=0;
-    quint32 dataSize();
+    // Writes compressed data with its length directly to device if
+    // file is still stored in archive, returns NotCopied otherwise
+    virtual Lilrcc::CopyResult copyCompressed(QIODevice *device);
+    // Same for decompressed data, possible only for uncompressed files
+    virtual Lilrcc::CopyResult copyUncompressed(QIODevice *device);
+    virtual quint32 dataSize();
+    // Milliseconds since epoch, zero if not known
+    virtual quint64 lastModified();
+    void setLastModified(quint64 lastModified);
 
 protected:
     quint32 m_dataSize;
+    quint64 m_lastModified;
 };
 
-class ResourceReader;
+// Abstract file stored in rcc, everything except name is taken from reader
+// tree entry, which is never changed after reader is created
+class RccResourceTreeFile : public ResourceTreeFile {
+public:
+    RccResourceTreeFile(ResourceReader *reader, quint32 entryNumber);
+    QByteArray getCompressed();
+    Lilrcc::CopyResult copyCompressed(QIODevice *device);
+    quint32 dataSize();
+    quint64 lastModified();
+    ResourceReader *reader();
+    quint32 dataOffset();
+protected:
+    ResourceReader *m_reader;
+    quint32 m_entryNumber;
+};
 
 // Uncompressed file from rcc
-class UncompressedResourceTreeFile : public ResourceTreeFile {
+class UncompressedResourceTreeFile : public RccResourceTreeFile {
 public:
-    UncompressedResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize);
+    UncompressedResourceTreeFile(ResourceReader *reader, quint32 entryNumber);
     QByteArray read(Lilrcc::Error &error);
+    // Only pages of range are touched
+    QByteArray readRange(qint64 offset, qint64 length, Lilrcc::Error &error);
+    Lilrcc::CopyResult copyUncompressed(QIODevice *device);
     Compression getCompression();
-    QByteArray getCompressed();
-protected:
-    ResourceReader *m_reader;
-    quint32 m_dataOffset;
 };
 
 // Zlib compressed file from rcc
-class ZlibResourceTreeFile : public ResourceTreeFile {
+class ZlibResourceTreeFile : public RccResourceTreeFile {
 public:
-    ZlibResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize);
+    ZlibResourceTreeFile(ResourceReader *reader, quint32 entryNumber);
     QByteArray read(Lilrcc::Error &error);
+    bool readInto(QByteArray &buffer, Lilrcc::Error &error);
     Compression getCompression();
-    QByteArray getCompressed();
-protected:
-    ResourceReader *m_reader;
-    quint32 m_dataOffset;
 };
 
 // Zstd compressed file from rcc
-class ZstdResourceTreeFile : public ResourceTreeFile {
+class ZstdResourceTreeFile : public RccResourceTreeFile {
 public:
-    ZstdResourceTreeFile(QString name, quint32 nameHash, ResourceReader *reader, quint32 dataOffset, quint32 dataSize);
+    ZstdResourceTreeFile(ResourceReader *reader, quint32 entryNumber);
     QByteArray read(Lilrcc::Error &error);
+    bool readInto(QByteArray &buffer, Lilrcc::Error &error);
     Compression getCompression();
-    QByteArray getCompressed();
-protected:
-    ResourceReader *m_reader;
-    quint32 m_dataOffset;
 };
 
-// QByteArray file
+// QByteArray file, data is stored already compressed with compression
 class QByteArrayResourceTreeFile : public ResourceTreeFile {
 public:
-    QByteArrayResourceTreeFile(QString name, quint32 nameHash, QByteArray data);
+    QByteArrayResourceTreeFile(QString name, quint32 nameHash, QByteArray data, Compression compression = NoCompression);
     QByteArray read(Lilrcc::Error &error);
+    bool readInto(QByteArray &buffer, Lilrcc::Error &error);
     Compression getCompression();
     QByteArray getCompressed();
 protected:
     QByteArray m_data;
+    Compression m_compression;
 };
 
 #endif // TREE_H